@@ -4,6 +4,7 @@
 #define BITS_PER_LONG 32
 #endif /* CONFIG_64BIT */
 
+#define BITS_PER_LONG_LONG 64
 #define BITS_PER_BYTE 8
 #define DIV_ROUND_UP(n, d) (((n) + (d)-1) / (d))
 
@@ -25,6 +26,8 @@
  * GENMASK_ULL(39, 21) gives us the 64bit vector 0x000000ffffe00000.
  */
 #define GENMASK(h, l) (((~0U) << (l)) & (~0U >> (BITS_PER_LONG - (h)-1)))
+#define GENMASK_ULL(h, l)                                                     \
+  (((~0ULL) << (l)) & (~0ULL >> (BITS_PER_LONG_LONG - (h)-1)))
 
 #define NBITS2(n) ((n & 2) ? 1 : 0)
 #define NBITS4(n) ((n & (0xC)) ? (2 + NBITS2 (n >> 2)) : (NBITS2 (n)))
@@ -30,7 +30,9 @@ enum ins_opcode_t
   ALLOC, // Allocate memory
   FREE,  // Deallocated a memory block
   READ,  // Write data to a byte on memory
-  WRITE  // Read data from a byte on memory
+  WRITE, // Read data from a byte on memory
+  FORK   // Duplicate the process, memory is shared copy-on-write, the next
+         // [arg_0] instructions are left to the child
 };
 
 /* instructions executed by the CPU */
@@ -89,9 +91,10 @@ struct pcb_t
   struct mm_struct *mm;
   struct memphy_struct *mram;
   struct memphy_struct **mswp;
-  struct memphy_struct *active_mswp;
-
-  pthread_mutex_t *mlock;
+  struct memphy_struct *active_mswp; /* first of the PAGING_MAX_MMSWP swap
+                                      * devices, the PTE swap type picks */
+  int node;  /* MEMRAM node of the CPU running it */
+  int stall; /* time slots left waiting on swap device seeks */
 #endif
   struct page_table_t *page_table; // Page table
   uint32_t bp;                     // Break pointer
@@ -5,5 +5,8 @@
 
 struct pcb_t * load(const char * path);
 
+/* Hand out a fresh PID, loaded and forked processes alike */
+uint32_t alloc_pid(void);
+
 #endif
 
@@ -3,68 +3,164 @@
 #include "bitops.h"
 #include "common.h"
 
-/* CPU Bus definition */
-#define PAGING_CPU_BUS_WIDTH 22  /* 22bit bus - MAX SPACE 4MB */
-#define PAGING_PAGESZ 256        /* 256B or 8-bits PAGE NUMBER */
-#define PAGING_MEMRAMSZ BIT (10) /* 1MB */
+/* CPU Bus definition. Page numbers are ints, so the bus cannot go past
+ * 31 bits plus the page shift without widening them */
+#define PAGING_CPU_BUS_WIDTH 32  /* 32bit bus - MAX SPACE 4GB */
+#define PAGING_PAGESZ paging_pagesz /* 256B by default, set by the config */
+#define PAGING_PAGE_SHIFT paging_pgshift
+#define PAGING_DEFAULT_PAGESZ 256
+#define PAGING_MIN_PAGESZ 32
+#define PAGING_MAX_PAGESZ 4096
+#define PAGING_MEMRAMSZ BIT (10) /* 1KB */
 #define PAGING_PAGE_ALIGNSZ(sz)                                               \
   (DIV_ROUND_UP (sz, PAGING_PAGESZ) * PAGING_PAGESZ)
 
-#define PAGING_MEMSWPSZ BIT (14) /* 16MB */
+#define PAGING_MEMSWPSZ BIT (14) /* 16KB */
 #define PAGING_SWPFPN_OFFSET 5
 /* Page table size = 2 ^ (paging cpu bus width - page size) */
 #define PAGING_MAX_PGN                                                        \
-  (DIV_ROUND_UP (BIT (PAGING_CPU_BUS_WIDTH), PAGING_PAGESZ))
+  ((int)DIV_ROUND_UP (BIT_ULL (PAGING_CPU_BUS_WIDTH), PAGING_PAGESZ))
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
+
+/* Page-out daemon watermarks, in percent of the MEMRAM frames */
+#define PAGING_KSWAPD_LOWMARK 10
+#define PAGING_KSWAPD_HIGHMARK 25
+#define PAGING_KSWAPD_MARK(mp, pct)                                           \
+  ((mp)->maxfpn * (pct) / 100 > 0 ? (mp)->maxfpn * (pct) / 100 : 1)
+
+/* Swap clustering: pages evicted together, readahead window bounds */
+#define PAGING_SWAP_CLUSTER 8
+#define PAGING_RA_MINWIN 1
+#define PAGING_RA_INITWIN 4
+#define PAGING_RA_MAXWIN 16
+
+/* Swap slot allocation across the devices, demotion threshold of a tier
+ * in percent of its slots in use */
+#define SWAP_STRIPE 0 /* devices take turns */
+#define SWAP_TIER 1   /* fastest first, cold pages demoted */
+#define PAGING_SWAP_DEMOTE_MARK 75
+
+/* Page access counts: saturation, the count a swapped out page needs to
+ * be promoted to a faster tier, and the time slots between two halvings */
+#define PAGING_HEAT_MAX 255
+#define PAGING_HEAT_HOT 4
+#define PAGING_HEAT_INTERVAL 8
+
+/* NUMA: placement policies, access latency to the local and to a remote
+ * node, remote accesses in a row that get a page migrated */
+#define NUMA_FIRST_TOUCH 0 /* node of the CPU first touching the page */
+#define NUMA_INTERLEAVE 1  /* nodes take turns */
+#define PAGING_NUMA_LOCAL_LAT 10
+#define PAGING_NUMA_REMOTE_LAT 25 /* unless the config sets it */
+#define PAGING_NUMA_MIGRATE_HITS 2
+
+/* Sequential devices: head travel costing one time slot of seek */
+#define PAGING_SEEK_SLOTSZ BIT (16)
+
+/* Block layer: dispatch policies, device model and queue limits. Times
+ * are in ticks, PAGING_BLK_TICKS to a time slot */
+#define BLK_SCHED_NOOP 0     /* submit order */
+#define BLK_SCHED_DEADLINE 1 /* sorted, expired requests first */
+#define BLK_SCHED_SCAN 2     /* elevator sweeping both ways */
+#define PAGING_BLK_TICKS 1000
+#define PAGING_BLK_BANDWIDTH BIT (14) /* bytes per time slot */
+#define PAGING_BLK_LATENCY 200        /* ticks per dispatched request */
+#define PAGING_BLK_QDEPTH 32
+#define PAGING_BLK_RD_EXPIRE (1 * PAGING_BLK_TICKS)
+#define PAGING_BLK_WR_EXPIRE (5 * PAGING_BLK_TICKS)
+
+/* io_uring swap files: ring size and the direct I/O block boundary */
+#define PAGING_URING_DEPTH 64
+#define PAGING_URING_ALIGN 512
+
+/* Compressed swap pool: PTE swap type of its entries, size in bytes, at
+ * most a share of MEMRAM in percent */
+#define PAGING_ZSWAP_SWPTYP 0x1F
+#define PAGING_ZSWAP_POOLSZ BIT (14)
+#define PAGING_ZSWAP_POOLPCT 20
+#define PAGING_ZSWAP_MAXENT 4096
+
+/* Page geometry, chosen at startup */
+extern int paging_pagesz;
+extern int paging_pgshift;
+extern int paging_huge_nr;
+
+/* Two level page table: PTEs per leaf, leaves per directory */
+#define PAGING_PTBL_LEAFBITS 7
+#define PAGING_PTBL_LEAFSZ BIT (PAGING_PTBL_LEAFBITS)
+#define PAGING_PTBL_DIRSZ DIV_ROUND_UP (PAGING_MAX_PGN, PAGING_PTBL_LEAFSZ)
+#define PAGING_PTBL_DIR(pgn) ((pgn) >> PAGING_PTBL_LEAFBITS)
+#define PAGING_PTBL_IDX(pgn) ((pgn) & (PAGING_PTBL_LEAFSZ - 1))
+
+/* Huge pages: a PTE maps 2^order contiguous frames, order 0 disables */
+#define PAGING_HUGE_NR paging_huge_nr
+#define PAGING_MAX_HUGE_ORDER PAGING_PTBL_LEAFBITS
+
+/* Slab size classes, requests up to the largest one are packed */
+#define PAGING_SLAB_MINSZ 16
+#define PAGING_SLAB_MAXSZ                                                     \
+  ((PAGING_SLAB_MINSZ << (PAGING_SLAB_NCLASS - 1)) < PAGING_PAGESZ / 2        \
+       ? (PAGING_SLAB_MINSZ << (PAGING_SLAB_NCLASS - 1))                      \
+       : PAGING_PAGESZ / 2)
+
+/* Same-page merging scan period, in time slots */
+#define PAGING_KSM_INTERVAL 4
+
 /* PTE BIT */
-#define PAGING_PTE_PRESENT_MASK BIT (31)
-#define PAGING_PTE_SWAPPED_MASK BIT (30)
-#define PAGING_PTE_RESERVE_MASK BIT (29)
-#define PAGING_PTE_DIRTY_MASK BIT (28)
-#define PAGING_PTE_EMPTY01_MASK BIT (14)
-#define PAGING_PTE_EMPTY02_MASK BIT (13)
+#define PAGING_PTE_PRESENT_MASK BIT_ULL (63)
+#define PAGING_PTE_SWAPPED_MASK BIT_ULL (62)
+#define PAGING_PTE_RESERVE_MASK BIT_ULL (61)
+#define PAGING_PTE_DIRTY_MASK BIT_ULL (60)
+#define PAGING_PTE_COW_MASK BIT_ULL (59) /* shared read-only, copy on write */
+#define PAGING_PTE_HUGE_MASK BIT_ULL (58) /* maps PAGING_HUGE_NR frames */
 
 /* PTE BIT PRESENT */
 #define PAGING_PTE_SET_PRESENT(pte) (pte = pte | PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte & PAGING_PTE_PRESENT_MASK)
+#define PAGING_PAGE_SWAPPED(pte) (pte & PAGING_PTE_SWAPPED_MASK)
 
 /* USRNUM */
-#define PAGING_PTE_USRNUM_LOBIT 15
-#define PAGING_PTE_USRNUM_HIBIT 27
+#define PAGING_PTE_USRNUM_LOBIT 45
+#define PAGING_PTE_USRNUM_HIBIT 57
 /* FPN */
 #define PAGING_PTE_FPN_LOBIT 0
-#define PAGING_PTE_FPN_HIBIT 12
+#define PAGING_PTE_FPN_HIBIT 39
 /* SWPTYP */
 #define PAGING_PTE_SWPTYP_LOBIT 0
 #define PAGING_PTE_SWPTYP_HIBIT 4
 /* SWPOFF */
 #define PAGING_PTE_SWPOFF_LOBIT 5
-#define PAGING_PTE_SWPOFF_HIBIT 25
+#define PAGING_PTE_SWPOFF_HIBIT 44
 
 #define PAGING_PTE_USRNUM_MASK                                                \
-  GENMASK (PAGING_PTE_USRNUM_HIBIT, PAGING_PTE_USRNUM_LOBIT)
+  GENMASK_ULL (PAGING_PTE_USRNUM_HIBIT, PAGING_PTE_USRNUM_LOBIT)
 #define PAGING_PTE_FPN_MASK                                                   \
-  GENMASK (PAGING_PTE_FPN_HIBIT, PAGING_PTE_FPN_LOBIT)
+  GENMASK_ULL (PAGING_PTE_FPN_HIBIT, PAGING_PTE_FPN_LOBIT)
 #define PAGING_PTE_SWPTYP_MASK                                                \
-  GENMASK (PAGING_PTE_SWPTYP_HIBIT, PAGING_PTE_SWPTYP_LOBIT)
+  GENMASK_ULL (PAGING_PTE_SWPTYP_HIBIT, PAGING_PTE_SWPTYP_LOBIT)
 #define PAGING_PTE_SWPOFF_MASK                                                \
-  GENMASK (PAGING_PTE_SWPOFF_HIBIT, PAGING_PTE_SWPOFF_LOBIT)
+  GENMASK_ULL (PAGING_PTE_SWPOFF_HIBIT, PAGING_PTE_SWPOFF_LOBIT)
+
+/* Frames and swap slots are numbered by int, whatever the PTE fields hold:
+ * a device has at most 2^31 - 1 of them, 512GB with the default page size
+ * and 8TB with the largest one */
+#define PAGING_MAX_NRFRAME 0x7FFFFFFF
 
 /* OFFSET */
 #define PAGING_ADDR_OFFST_LOBIT 0
-#define PAGING_ADDR_OFFST_HIBIT (NBITS (PAGING_PAGESZ) - 1)
+#define PAGING_ADDR_OFFST_HIBIT (PAGING_PAGE_SHIFT - 1)
 
 /* PAGE Num */
-#define PAGING_ADDR_PGN_LOBIT NBITS (PAGING_PAGESZ)
+#define PAGING_ADDR_PGN_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_ADDR_PGN_HIBIT (PAGING_CPU_BUS_WIDTH - 1)
 
 /* Frame PHY Num */
-#define PAGING_ADDR_FPN_LOBIT NBITS (PAGING_PAGESZ)
+#define PAGING_ADDR_FPN_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_ADDR_FPN_HIBIT (NBITS (PAGING_MEMRAMSZ) - 1)
 
 /* SWAPFPN */
-#define PAGING_SWP_LOBIT NBITS (PAGING_PAGESZ)
+#define PAGING_SWP_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_SWP_HIBIT (NBITS (PAGING_MEMSWPSZ) - 1)
 #define PAGING_SWP(pte) ((pte & PAGING_SWP_MASK) >> PAGING_SWPFPN_OFFSET)
 
@@ -73,8 +169,8 @@
 #define CLRBIT(v, mask) (v = v & ~mask)
 
 #define SETVAL(v, value, mask, offst)                                         \
-  (v = (v & ~mask) | ((value << offst) & mask))
-#define GETVAL(v, mask, offst) ((v & mask) >> offst)
+  (v = (v & ~mask) | (((pte_t)(value) << offst) & mask))
+#define GETVAL(v, mask, offst) (((v) & mask) >> offst)
 
 /* Masks */
 #define PAGING_OFFST_MASK                                                     \
@@ -95,6 +191,17 @@
 /* Extract SWAPTYPE */
 #define PAGING_FPN(x) GETVAL (x, PAGING_FPN_MASK, PAGING_ADDR_FPN_LOBIT)
 
+/* Physical address of a frame */
+#define PAGING_FRAME_ADDR(fpn) ((addr_t)(fpn) << PAGING_PAGE_SHIFT)
+
+/* Extract fields of a PTE */
+#define PAGING_PTE_FPN(pte)                                                   \
+  GETVAL (pte, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT)
+#define PAGING_PTE_SWPTYP(pte)                                                \
+  GETVAL (pte, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT)
+#define PAGING_PTE_SWPOFF(pte)                                                \
+  GETVAL (pte, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT)
+
 /* Memory range operator */
 #define INCLUDE(x1, x2, y1, y2) (((y1 - x1) * (x2 - y2) >= 0) ? 1 : 0)
 #define OVERLAP(x1, x2, y1, y2) (((y2 - x1) * (x2 - y1) >= 0) ? 1 : 0)
@@ -104,18 +211,47 @@ struct vm_rg_struct *init_vm_rg (int rg_start, int rg_endi);
 int enlist_vm_rg_node (struct vm_rg_struct **rglist,
                        struct vm_rg_struct *rgnode);
 int enlist_pgn_node (struct pgn_t **pgnlist, int pgn);
-int vmap_page_range (struct pcb_t *caller, int addr, int pgnum,
+int vmap_page_range (struct pcb_t *caller, addr_t addr, int pgnum,
                      struct framephy_struct *frames,
                      struct vm_rg_struct *ret_rg);
-int vm_map_ram (struct pcb_t *caller, int mapstart, int incpgnum,
+int vm_map_ram (struct pcb_t *caller, addr_t mapstart, int incpgnum,
                 struct vm_rg_struct *ret_rg);
 int alloc_pages_range (struct pcb_t *caller, int incpgnum,
                        struct framephy_struct **frm_lst);
+int vm_populate_rg (struct pcb_t *caller, int rg_start, int rg_end);
+int get_free_frame (struct pcb_t *caller, int *retfpn);
+int swap_out_page (struct memphy_struct *mram, struct memphy_struct *mswp,
+                   struct memcg_struct *memcg, int *retfpn);
+int swap_out_mm (struct memphy_struct *mram, struct memphy_struct *mswp,
+                 struct mm_struct *mm);
+int put_free_frame (struct memphy_struct *mram, struct memphy_struct *mswp,
+                    int fpn);
+int unmap_frame (struct memphy_struct *mram, struct memphy_struct *mswp, int fpn,
+                 struct mm_struct *mm, int pgn);
+int unmap_huge (struct memphy_struct *mram, struct mm_struct *mm, int fpn);
+int put_swap_entry (struct memphy_struct *mswp, pte_t pte);
+struct memphy_struct *swap_dev (struct memphy_struct *mswp, int swptyp);
+void swap_set_owner (struct memphy_struct *dev, int swpoff,
+                     struct mm_struct *mm, int pgn, int heat);
+int swap_alloc (struct memphy_struct *mswp, int num, int *retswptyp,
+                int *retswpoff);
+int swap_demote (struct memphy_struct *mswp);
+int swap_promote (struct memphy_struct *mswp);
+void frame_cool (struct memphy_struct *mram);
+int numa_node (struct pcb_t *caller);
+int numa_dump (struct memphy_struct *mram);
+int kswapd_balance (struct memphy_struct *mram, struct memphy_struct *mswp);
 int __swap_cp_page (struct memphy_struct *mpsrc, int srcfpn,
                     struct memphy_struct *mpdst, int dstfpn);
-int pte_set_fpn (uint32_t *pte, int fpn);
-int pte_set_swap (uint32_t *pte, int swptyp, int swpoff);
-int init_pte (uint32_t *pte,
+int pte_set_fpn (pte_t *pte, int fpn);
+int paging_setup (int pagesz, int huge_order);
+pte_t pte_get (struct mm_struct *mm, int pgn);
+void pte_store (pte_t *pte, pte_t val);
+void mm_seq_begin (struct mm_struct *mm);
+void mm_seq_end (struct mm_struct *mm);
+pte_t *pte_ptr (struct mm_struct *mm, int pgn);
+int pte_set_swap (pte_t *pte, int swptyp, int swpoff);
+int init_pte (pte_t *pte,
               int pre,     // present
               int fpn,     // FPN
               int drt,     // dirty
@@ -123,16 +259,21 @@ int init_pte (uint32_t *pte,
               int swptyp,  // swap type
               int swpoff); // swap offset
 int __alloc (struct pcb_t *caller, int vmaid, int rgid, int size,
-             uint32_t *alloc_addr);
+             addr_t *alloc_addr);
 int __free (struct pcb_t *caller, int vmaid, int rgid);
 int __read (struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write (struct pcb_t *caller, int vmaid, int rgid, int offset,
              BYTE value);
 int init_mm (struct mm_struct *mm, struct pcb_t *caller);
+void mm_charge (struct mm_struct *mm, int nr);
+int mm_release (struct mm_struct *mm, struct memphy_struct *mswp);
+int copy_mm (struct mm_struct *newmm, struct mm_struct *mm,
+             struct pcb_t *caller);
 
 /* VM prototypes */
 int pgalloc (struct pcb_t *proc, uint32_t size, uint32_t reg_index);
 int pgfree_data (struct pcb_t *proc, uint32_t reg_index);
+int pgfork (struct pcb_t *proc, struct pcb_t *child);
 int pgread (struct pcb_t *proc,    // Process executing the instruction
             uint32_t source,       // Index of source register
             uint32_t offset,       // Source address = [source] + [offset]
@@ -147,23 +288,113 @@ int validate_overlap_vm_area (struct pcb_t *caller, int vmaid, int vmastart,
                               int vmaend);
 int get_free_vmrg_area (struct pcb_t *caller, int vmaid, int size,
                         struct vm_rg_struct *newrg);
+int vm_alloc_rg (struct pcb_t *caller, int vmaid, int size,
+                 struct vm_rg_struct *newrg);
 int inc_vma_limit (struct pcb_t *caller, int vmaid, int inc_sz,
                    struct vm_rg_struct *newrg);
-int find_victim_page (struct mm_struct *mm, int *pgn);
+int find_victim_page (struct memphy_struct *mram, struct memcg_struct *memcg,
+                      struct mm_struct **vicmm, int *retpgn, int *retfpn);
+int frame_trylock_mappers (struct memphy_struct *mram, int fpn);
+void frame_unlock_mappers (struct memphy_struct *mram, int fpn);
 struct vm_area_struct *get_vma_by_num (struct mm_struct *mm, int vmaid);
+int free_pcb_memph (struct pcb_t *caller);
+int swap_in_mm (struct pcb_t *caller);
 
 /* MEMPHY protypes */
 int MEMPHY_get_freefp (struct memphy_struct *mp, int *fpn);
+int MEMPHY_get_freefp_node (struct memphy_struct *mp, int node, int *retfpn);
+int MEMPHY_get_freefp_near (struct memphy_struct *mp, int node, int *retfpn);
+int MEMPHY_node (struct memphy_struct *mp, int fpn);
+int MEMPHY_set_nodes (struct memphy_struct *mp, int nr_nodes, int remote_lat);
 int MEMPHY_put_freefp (struct memphy_struct *mp, int fpn);
-int MEMPHY_read (struct memphy_struct *mp, int addr, BYTE *value);
-int MEMPHY_write (struct memphy_struct *mp, int addr, BYTE data);
+int MEMPHY_get_freefp_range (struct memphy_struct *mp, int num, int *retfpn);
+int MEMPHY_set_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *owner,
+                     int pgn);
+int MEMPHY_add_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *mm,
+                     int pgn);
+int MEMPHY_del_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *mm,
+                     int pgn);
+int MEMPHY_read (struct memphy_struct *mp, addr_t addr, BYTE *value);
+int MEMPHY_write (struct memphy_struct *mp, addr_t addr, BYTE data);
+int MEMPHY_read_frame (struct memphy_struct *mp, int fpn, BYTE *buf);
+int MEMPHY_write_frame (struct memphy_struct *mp, int fpn, const BYTE *buf);
+int MEMPHY_clear_frame (struct memphy_struct *mp, int fpn);
 int MEMPHY_dump (struct memphy_struct *mp);
-int init_memphy (struct memphy_struct *mp, int max_size, int randomflg);
+int MEMPHY_take_stall (void);
+void MEMPHY_lock (struct memphy_struct *mp);
+void MEMPHY_unlock (struct memphy_struct *mp);
+int init_memphy (struct memphy_struct *mp, addr_t max_size, int randomflg);
+int init_memphy_file (struct memphy_struct *mp, addr_t max_size, int randomflg,
+                      const char *path);
+int MEMPHY_release (struct memphy_struct *mp);
+/* Free region prototypes */
+int freerg_init (struct vm_freerg_struct *frg);
+int freerg_insert (struct vm_freerg_struct *frg, unsigned long rg_start,
+                   unsigned long rg_end, struct vm_rg_struct *retrg);
+int freerg_alloc (struct vm_freerg_struct *frg, unsigned long size,
+                  struct vm_rg_struct *newrg);
+int freerg_copy (struct vm_freerg_struct *dst, struct vm_freerg_struct *src);
+int freerg_release (struct vm_freerg_struct *frg);
+
+/* Slab prototypes */
+int slab_alloc (struct pcb_t *caller, int vmaid, int size,
+                struct vm_rg_struct *newrg);
+int slab_free (struct mm_struct *mm, struct vm_rg_struct *rg);
+int slab_copy (struct mm_struct *newmm, struct mm_struct *mm);
+int slab_release (struct mm_struct *mm);
+
+/* KSM prototypes */
+int ksm_init (struct memphy_struct *mram);
+int ksm_scan (struct memphy_struct *mram, struct memphy_struct *mswp);
+
+/* Block layer prototypes */
+int blk_init (struct memphy_struct *mp, int sched, unsigned long bandwidth,
+              unsigned long latency);
+int blk_submit_read (struct memphy_struct *mp, int fpn,
+                     struct memphy_struct *mem, int memfpn);
+int blk_submit_write (struct memphy_struct *mp, int fpn, const BYTE *buf);
+int blk_read (struct memphy_struct *mp, int fpn, struct memphy_struct *mem,
+              int memfpn);
+int blk_unplug (struct memphy_struct *mp);
+int blk_dump (struct memphy_struct *mp, const char *name);
+
+/* io_uring swap file prototypes */
+struct swap_uring *uring_open (const char *path, addr_t size);
+int uring_submit (struct swap_uring *ring, int fpn, const BYTE *buf,
+                  struct memphy_struct *mem, int memfpn);
+int uring_rw (struct swap_uring *ring, int fpn, BYTE *buf, int wr);
+int uring_poll (struct swap_uring *ring);
+int uring_wait (struct swap_uring *ring);
+int uring_wait_reads (struct swap_uring *ring);
+int uring_close (struct swap_uring *ring);
+int uring_dump (struct swap_uring *ring, const char *name);
+
+/* ZSWAP prototypes */
+int zswap_store (struct memphy_struct *mram, int fpn, struct memphy_struct *mswp,
+                 struct mm_struct *owner, int pgn, int *retoff);
+int zswap_load (int off, struct memphy_struct *mram, int fpn);
+int zswap_invalidate (int off);
+int zswap_evict (int off, struct memphy_struct *mswp, int *retswptyp,
+                 int *retoff);
+int zswap_release (struct mm_struct *mm);
+int zswap_dump (void);
+
+/* Memory control group prototypes */
+struct memcg_struct *memcg_get (int id);
+int memcg_set_limit (int id, int limit, int soft);
+void memcg_charge (struct memcg_struct *memcg, int nr);
+int memcg_over (struct memcg_struct *memcg, int nr);
+struct memcg_struct *memcg_soft_excess (void);
+int memcg_reclaim (struct memphy_struct *mram, struct memphy_struct *mswp,
+                   struct memcg_struct *memcg, int *retfpn);
+int memcg_dump (void);
+
 /* DEBUG */
 int print_list_fp (struct framephy_struct *fp);
 int print_list_rg (struct vm_rg_struct *rg);
+int print_freerg (struct vm_freerg_struct *frg);
 int print_list_vma (struct vm_area_struct *rg);
 
 int print_list_pgn (struct pgn_t *ip);
-int print_pgtbl (struct pcb_t *ip, uint32_t start, uint32_t end);
+int print_pgtbl (struct pcb_t *ip, addr_t start, addr_t end);
 #endif
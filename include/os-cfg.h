@@ -3,12 +3,32 @@
 
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
+#define SCHED_LOAD_CONTROL /* suspend processes while thrashing */
 
 #define MM_PAGING
+#define MM_KSWAPD /* background page-out daemon */
+#define MM_ZSWAP  /* compressed in-RAM swap cache */
+#define MM_KSM    /* shared zero page and same-page merging */
+#define MM_DEMAND /* map frames on first touch, not at ALLOC */
+#define MM_SLAB   /* pack small regions into shared pages */
+#define MM_SEQ_SWAP /* swap devices are sequential, seeks stall the process */
+#define MM_BLK      /* swap I/O through request queues */
+#define MM_BLK_SCHED BLK_SCHED_DEADLINE
+#define MM_SWAP_POLICY SWAP_STRIPE /* or SWAP_TIER */
+// #define MM_SWAP_FILE "swap%d.img" /* sparse file backed swap devices */
+// #define MM_SWAP_URING /* swap files through io_uring, not mapped */
+#define MM_NUMA /* MEMRAM split in nodes, see the config */
+#define MM_NUMA_POLICY NUMA_FIRST_TOUCH /* or NUMA_INTERLEAVE */
+#define MM_MEMCG /* per group resident page limits, see the config */
 // #define MM_FIXED_MEMSZ
 #define VMDBG 1
 #define MMDBG 1
 #define IODUMP 1
 #define PAGETBL_DUMP 1
 
+/* Load control suspends MLQ processes and evicts their pages */
+#if defined(SCHED_LOAD_CONTROL) && !(defined(MM_PAGING) && defined(MLQ_SCHED))
+#undef SCHED_LOAD_CONTROL
+#endif
+
 #endif
@@ -1,13 +1,20 @@
 #ifndef OSMM_H
 #define OSMM_H
 
+#include <pthread.h>
+
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
+#define PAGING_MAX_NODES 4 /* max number of MEMRAM NUMA nodes */
+#define PAGING_MAX_MEMCG 8 /* max number of memory control groups */
 #define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_FREERG_NBINS 32 /* one size class per power of two */
+#define PAGING_SLAB_NCLASS 4    /* 16, 32, 64 and 128 byte objects */
 
 typedef char BYTE;
 typedef unsigned int uint32_t;
-typedef uint32_t addr_t;
+typedef unsigned long addr_t;
+typedef unsigned long long pte_t; /* 64-bit page table entry */
 
 struct pgn_t
 {
@@ -15,6 +22,33 @@ struct pgn_t
   struct pgn_t *pg_next;
 };
 
+/*
+ *  Memory control group, the processes sharing a resident page quota
+ */
+struct memcg_struct
+{
+  int id;
+  int used;  /* some process joined it */
+  int limit; /* hard limit in pages, 0 = none */
+  int soft;  /* soft limit in pages, 0 = none */
+  int usage; /* resident pages of the members, counted like their rss */
+
+  /* Statistics */
+  unsigned long nr_fault, nr_swapin, nr_swapout;
+  unsigned long nr_reclaim;   /* pages evicted to keep to the limits */
+  unsigned long nr_overlimit; /* pages charged over the hard limit */
+};
+
+/*
+ *  Extra mapper of a shared frame, chained from its frame table entry
+ */
+struct rmap_struct
+{
+  struct mm_struct *mm;
+  int pgn;
+  struct rmap_struct *rm_next;
+};
+
 /*
  *  Memory region struct
  */
@@ -24,6 +58,38 @@ struct vm_rg_struct
   unsigned long rg_end;
 
   struct vm_rg_struct *rg_next;
+
+  /* Free regions only: size class bin and address treap links, under a
+   * priority drawn once when the region is created */
+  struct vm_rg_struct *rg_sleft;
+  struct vm_rg_struct *rg_sright;
+  struct vm_rg_struct *rg_left;
+  struct vm_rg_struct *rg_right;
+  unsigned int rg_prio;
+};
+
+/*
+ *  Free regions of an area, binned by size and ordered by address
+ */
+struct vm_freerg_struct
+{
+  struct vm_rg_struct *bins[PAGING_FREERG_NBINS]; /* treap roots */
+  unsigned int binmap; /* bit set for every non-empty bin */
+  struct vm_rg_struct *root;
+};
+
+/*
+ *  Slab of same sized small regions packed into a page sized chunk
+ */
+struct vm_slab_struct
+{
+  unsigned long sl_start;
+  int sl_objsz;
+  int sl_nrobj;
+  int sl_nrfree;
+  BYTE *sl_used; /* one flag per object */
+
+  struct vm_slab_struct *sl_next;
 };
 
 /*
@@ -41,7 +107,7 @@ struct vm_area_struct
    * unsigned long vm_limit = vm_end - vm_start
    */
   struct mm_struct *vm_mm;
-  struct vm_rg_struct *vm_freerg_list;
+  struct vm_freerg_struct vm_freerg;
   struct vm_area_struct *vm_next;
 };
 
@@ -50,15 +116,45 @@ struct vm_area_struct
  */
 struct mm_struct
 {
-  uint32_t *pgd;
+  /* Two level page table, a leaf is allocated with its first PTE and
+   * [pgd_lo, pgd_hi) covers every allocated one. The directory itself only
+   * spans the leaves up to the highest one in use */
+  pte_t **pgd;
+  int pgd_nr; /* directory entries, grown with the highest leaf */
+  int pgd_lo;
+  int pgd_hi;
 
   struct vm_area_struct *mmap;
 
   /* Currently we support a fixed number of symbol */
   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
 
-  /* list of free page */
-  struct pgn_t *fifo_pgn;
+  /* Slabs of every small size class */
+  struct vm_slab_struct *slabs[PAGING_SLAB_NCLASS];
+
+  /* Adaptive swap-in readahead window, in pages */
+  int ra_win;
+
+  /* Resident pages, shared ones are accounted to every mapper */
+  int rss;
+
+  /* Group charged with the resident pages, shared by forked children */
+  struct memcg_struct *memcg;
+
+  /* Pages evicted while the process was suspended by load control */
+  struct pgn_t *ws_list;
+
+  /* Node taking the next frame under the interleave policy */
+  int numa_next;
+
+  /* Guards all of the above. Reclaim, merging and the compressed pool only
+   * ever trylock the mm of another process, recursive so that its owner
+   * may be among the mms they lock */
+  pthread_mutex_t mm_lock;
+
+  /* Odd while another process takes a resident PTE down, under mm_lock.
+   * The owner reads resident pages without the lock and checks it */
+  unsigned int mm_seq;
 };
 
 /*
@@ -71,21 +167,120 @@ struct framephy_struct
 
   /* Resereed for tracking allocated framed */
   struct mm_struct *owner;
+
+  /* Reverse map: page of owner mapped onto this frame */
+  int pgn;
+  int refbit; /* referenced since the clock hand last passed */
+  int heat;   /* accesses, halved every time slot. A swap slot keeps the
+               * heat of its page until the demotion sweep passes */
+  int rabit;  /* brought in by readahead, not referenced yet */
+  int remote; /* accesses in a row from a CPU off the frame node */
+  int swpoff; /* swap cache: slot holding a copy of the page, -1 if none */
+  int swptyp; /* swap cache: device of that slot */
+
+  /* Number of PTEs using the frame (swap: the slot), mappers other than
+   * owner are chained in rmap_list */
+  int mapcount;
+  struct rmap_struct *rmap_list;
+  unsigned int ksm_csum; /* content checksum seen by the last scan */
+
+  /* Free list of the frame table is doubly linked */
+  struct framephy_struct *fp_prev;
+  int isfree;
+};
+
+/*
+ * Block layer request: one frame of a swap device read or written
+ */
+struct blk_request
+{
+  int fpn; /* frame of the device */
+  int wr;
+
+  BYTE *data;               /* written page, copied at submit */
+  struct memphy_struct *mem; /* read destination frame */
+  int memfpn;
+
+  unsigned long submit; /* in ticks, PAGING_BLK_TICKS per time slot */
+  unsigned long deadline;
+  struct blk_request *next; /* submit order */
+};
+
+/*
+ * Request queue of a device, under the device lock
+ */
+struct blk_queue
+{
+  int sched;               /* BLK_SCHED_* dispatch policy */
+  unsigned long bandwidth; /* bytes per time slot */
+  unsigned long latency;   /* ticks per dispatched request */
+
+  struct blk_request *head, *tail;
+  int nr;
+
+  int pos; /* frame following the last dispatch, where the head is */
+  int dir; /* SCAN direction, 1 up and -1 down */
+  unsigned long clock; /* ticks, device busy until then */
+
+  /* Statistics, latencies in ticks from submit to completion */
+  unsigned long nr_rd, nr_wr;
+  unsigned long nr_dispatch, nr_merged, nr_hit;
+  unsigned long rd_wait, wr_wait;
 };
 
+struct swap_uring;
+
 struct memphy_struct
 {
   /* Basic field of data and size */
   BYTE *storage;
-  int maxsz;
+  addr_t maxsz;
+  int fd; /* mapped backing file, -1 when storage is malloc'd */
 
   /* Sequential device fields */
   int rdmflg; /* randomly or serial */
-  int cursor;
+  addr_t cursor;
 
-  /* Management structure */
-  struct framephy_struct *free_fp_list;
+  /* Management structure, one free list per node */
+  struct framephy_struct *free_fp_list[PAGING_MAX_NODES];
   struct framephy_struct *used_fp_list;
+
+  /* NUMA nodes: runs of node_span frames, the last one takes the rest */
+  int nr_nodes;
+  int node_span;
+  int remote_lat; /* access latency from another node, local is fixed */
+  int node_free[PAGING_MAX_NODES];
+  unsigned long nr_local, nr_remote, nr_migrated;
+
+  /* MEMRAM only: faults served from swap, the thrashing indicator */
+  unsigned long nr_majflt;
+
+  /* Frame table, one entry per frame indexed by fpn. The entries are also
+   * the nodes of free_fp_list and keep the reverse map of mapped frames */
+  struct framephy_struct *frmtbl;
+  int maxfpn;
+  int free_fpcnt;
+  int clock_hand;   /* global replacement position in frmtbl */
+  int cluster_next; /* where the next run of swap slots is searched */
+  int zero_fpn;     /* shared read-only zero frame, -1 if none */
+  int memcg_acct;   /* frames are charged to the group of their owner */
+
+  /* Statistics of page transfers */
+  unsigned long nr_rdpg;
+  unsigned long nr_wrpg;
+
+  /* Sequential device: head travel in bytes and the latency it cost */
+  unsigned long seek_dist;
+  unsigned long seek_slots;
+
+  /* Swap I/O request queue, NULL when accessed directly */
+  struct blk_queue *bq;
+
+  /* Swap file on an io_uring, NULL when storage holds the content */
+  struct swap_uring *ring;
+
+  /* Free list and frame table, taken after any mm lock */
+  pthread_mutex_t lock;
 };
 
 #endif
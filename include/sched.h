@@ -36,4 +36,11 @@ void decrease_q_time_left ();
  */
 int queue_time_up ();
 
+/* For SCHED_LOAD_CONTROL only,
+ * the medium-term scheduler, run once per time slot
+ */
+struct memphy_struct;
+void load_control (struct memphy_struct *mram, int nr_cpus);
+void load_control_dump (void);
+
 #endif
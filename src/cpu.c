@@ -1,7 +1,11 @@
 
 #include "cpu.h"
+#include "loader.h"
 #include "mem.h"
 #include "mm.h"
+#include "sched.h"
+#include <stdio.h>
+#include <stdlib.h>
 
 int
 calc (struct pcb_t *proc)
@@ -59,6 +63,36 @@ write (struct pcb_t *proc,   // Process executing the instruction
   return write_mem (proc->regs[destination] + offset, proc, data);
 }
 
+#ifdef MM_PAGING
+int
+fork_proc (struct pcb_t *proc, uint32_t skip)
+{
+  /* Same program, registers and program counter as the parent */
+  struct pcb_t *child = (struct pcb_t *)malloc (sizeof (struct pcb_t));
+  *child = *proc;
+  child->pid = alloc_pid ();
+  child->stall = 0;
+  child->page_table
+      = (struct page_table_t *)malloc (sizeof (struct page_table_t));
+
+  if (pgfork (proc, child) != 0)
+    {
+      mm_release (child->mm, proc->active_mswp);
+      free (child->page_table);
+      free (child);
+      return 1;
+    }
+
+  printf ("\tForked process %2d from %2d\n", child->pid, proc->pid);
+  add_proc (child);
+
+  /* The parent skips the instructions left to the child */
+  proc->pc += skip;
+
+  return 0;
+}
+#endif
+
 int
 run (struct pcb_t *proc)
 {
@@ -102,6 +136,13 @@ run (struct pcb_t *proc)
       stat = pgwrite (proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #else
       stat = write (proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+      break;
+    case FORK:
+#ifdef MM_PAGING
+      stat = fork_proc (proc, ins.arg_0);
+#else
+      stat = 1; /* Needs paging for copy-on-write */
 #endif
       break;
     default:
@@ -11,6 +11,7 @@ static uint32_t avail_pid = 1;
 #define OPT_FREE "free"
 #define OPT_READ "read"
 #define OPT_WRITE "write"
+#define OPT_FORK "fork"
 
 static enum ins_opcode_t
 get_opcode (char *opt)
@@ -35,6 +36,10 @@ get_opcode (char *opt)
     {
       return WRITE;
     }
+  else if (!strcmp (opt, OPT_FORK))
+    {
+      return FORK;
+    }
   else
     {
       printf ("Opcode: %s\n", opt);
@@ -42,13 +47,18 @@ get_opcode (char *opt)
     }
 }
 
+uint32_t
+alloc_pid (void)
+{
+  return __sync_fetch_and_add (&avail_pid, 1);
+}
+
 struct pcb_t *
 load (const char *path)
 {
   /* Create new PCB for the new process */
   struct pcb_t *proc = (struct pcb_t *)malloc (sizeof (struct pcb_t));
-  proc->pid = avail_pid;
-  avail_pid++;
+  proc->pid = alloc_pid ();
   proc->page_table
       = (struct page_table_t *)malloc (sizeof (struct page_table_t));
   proc->bp = PAGE_SIZE;
@@ -75,6 +85,10 @@ load (const char *path)
         {
         case CALC:
           break;
+        case FORK: /* The count of instructions left to the child, if any */
+          if (fscanf (file, "%u", &proc->code->text[i].arg_0) != 1)
+            proc->code->text[i].arg_0 = 0;
+          break;
         case ALLOC:
           fscanf (file, "%u %u\n", &proc->code->text[i].arg_0,
                   &proc->code->text[i].arg_1);
@@ -0,0 +1,443 @@
+// #ifdef MM_BLK
+/*
+ * PAGING based Memory Management
+ * Swap block layer mm/mm-blk.c
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Swap devices are reached through a request queue. Writes are queued with
+ * a copy of the page and reach the device once the queue fills up, a read
+ * needs them or kswapd runs it. Reads wait for the queue to be dispatched.
+ * Dispatch follows the device scheduler, a request picked takes along the
+ * queued ones of the same direction on adjacent frames, so that the run
+ * costs one request latency and one seek. Time is simulated: the device
+ * clock advances by the cost of every run and a request latency spans from
+ * its submission to the completion of its run.
+ */
+
+static const char *const blk_sched_name[] = {
+  [BLK_SCHED_NOOP] = "noop",
+  [BLK_SCHED_DEADLINE] = "deadline",
+  [BLK_SCHED_SCAN] = "scan",
+};
+
+/*
+ *  blk_pick_noop - oldest request first
+ *  @bq: request queue
+ *  @now: device clock
+ */
+static struct blk_request *
+blk_pick_noop (struct blk_queue *bq, unsigned long now)
+{
+  return bq->head;
+}
+
+/*
+ *  blk_pick_deadline - expired requests first, reads before writes,
+ *  otherwise the closest one ahead of the head, wrapping around
+ *  @bq: request queue
+ *  @now: device clock
+ */
+static struct blk_request *
+blk_pick_deadline (struct blk_queue *bq, unsigned long now)
+{
+  struct blk_request *rq, *best = NULL, *first = NULL;
+
+  for (rq = bq->head; rq != NULL; rq = rq->next)
+    if (rq->deadline <= now && (best == NULL || (!rq->wr && best->wr)))
+      best = rq;
+
+  if (best != NULL)
+    return best;
+
+  for (rq = bq->head; rq != NULL; rq = rq->next)
+    {
+      if (rq->fpn >= bq->pos && (best == NULL || rq->fpn < best->fpn))
+        best = rq;
+      if (first == NULL || rq->fpn < first->fpn)
+        first = rq;
+    }
+
+  return (best != NULL) ? best : first;
+}
+
+/*
+ *  blk_pick_scan - closest request in the sweep direction, turning back
+ *  at the last one
+ *  @bq: request queue
+ *  @now: device clock
+ */
+static struct blk_request *
+blk_pick_scan (struct blk_queue *bq, unsigned long now)
+{
+  struct blk_request *rq, *best;
+
+  for (;;)
+    {
+      best = NULL;
+      for (rq = bq->head; rq != NULL; rq = rq->next)
+        if (bq->dir > 0 ? (rq->fpn >= bq->pos
+                           && (best == NULL || rq->fpn < best->fpn))
+                        : (rq->fpn < bq->pos
+                           && (best == NULL || rq->fpn > best->fpn)))
+          best = rq;
+
+      if (best != NULL)
+        return best;
+
+      bq->dir = -bq->dir;
+    }
+}
+
+static struct blk_request *(*const blk_pick[]) (struct blk_queue *,
+                                                unsigned long) = {
+  [BLK_SCHED_NOOP] = blk_pick_noop,
+  [BLK_SCHED_DEADLINE] = blk_pick_deadline,
+  [BLK_SCHED_SCAN] = blk_pick_scan,
+};
+
+/*
+ *  blk_now - current time in ticks
+ */
+static unsigned long
+blk_now (void)
+{
+  return (unsigned long)current_time () * PAGING_BLK_TICKS;
+}
+
+/*
+ *  blk_find - queued request on a frame
+ *  @bq: request queue
+ *  @fpn: frame of the device
+ *  @wr: direction
+ */
+static struct blk_request *
+blk_find (struct blk_queue *bq, int fpn, int wr)
+{
+  struct blk_request *rq;
+
+  for (rq = bq->head; rq != NULL; rq = rq->next)
+    if (rq->fpn == fpn && rq->wr == wr)
+      return rq;
+
+  return NULL;
+}
+
+static void
+blk_enqueue (struct blk_queue *bq, struct blk_request *rq)
+{
+  rq->submit = blk_now ();
+  rq->deadline = rq->submit
+                 + (rq->wr ? PAGING_BLK_WR_EXPIRE : PAGING_BLK_RD_EXPIRE);
+  rq->next = NULL;
+
+  if (bq->tail != NULL)
+    bq->tail->next = rq;
+  else
+    bq->head = rq;
+  bq->tail = rq;
+  bq->nr++;
+}
+
+static void
+blk_unlink (struct blk_queue *bq, struct blk_request *rq)
+{
+  struct blk_request **pp, *prev = NULL;
+
+  for (pp = &bq->head; *pp != rq; pp = &(*pp)->next)
+    prev = *pp;
+
+  *pp = rq->next;
+  if (bq->tail == rq)
+    bq->tail = prev;
+  bq->nr--;
+}
+
+/*
+ *  blk_dispatch - carry out a request along with the adjacent ones
+ *  @mp: device
+ *  @rq: request picked by the scheduler
+ *  @now: device clock, advanced by the cost of the run
+ */
+static void
+blk_dispatch (struct memphy_struct *mp, struct blk_request *rq,
+              unsigned long *now)
+{
+  struct blk_queue *bq = mp->bq;
+  struct blk_request *run = NULL, **tail = &run, *it;
+  unsigned long seek = mp->seek_slots, cost;
+  int lo = rq->fpn, hi = rq->fpn, wr = rq->wr, fpn, nr = 0;
+
+  while (lo > 0 && blk_find (bq, lo - 1, wr) != NULL)
+    lo--;
+  while (blk_find (bq, hi + 1, wr) != NULL)
+    hi++;
+
+  /* One pass over the frames, low to high */
+  for (fpn = lo; fpn <= hi; fpn++)
+    {
+      it = blk_find (bq, fpn, wr);
+      blk_unlink (bq, it);
+
+      /* A swap file completes it in the background, unless it cannot
+       * take the request, which is then carried out right away */
+      if (mp->ring == NULL
+          || uring_submit (mp->ring, fpn, it->data, it->mem, it->memfpn) != 0)
+        {
+          if (wr)
+            MEMPHY_write_frame (mp, fpn, it->data);
+          else
+            {
+              BYTE page[PAGING_MAX_PAGESZ];
+
+              MEMPHY_read_frame (mp, fpn, page);
+              MEMPHY_write_frame (it->mem, it->memfpn, page);
+            }
+        }
+
+      *tail = it;
+      tail = &it->next;
+      nr++;
+    }
+  *tail = NULL;
+
+  cost = bq->latency
+         + (unsigned long)nr * PAGING_PAGESZ * PAGING_BLK_TICKS / bq->bandwidth
+         + (mp->seek_slots - seek) * PAGING_BLK_TICKS;
+  *now += cost;
+
+  bq->pos = hi + 1;
+  bq->nr_dispatch++;
+  bq->nr_merged += nr - 1;
+
+  while (run != NULL)
+    {
+      it = run;
+      run = run->next;
+
+      if (it->wr)
+        bq->wr_wait += *now - it->submit;
+      else
+        bq->rd_wait += *now - it->submit;
+
+      free (it->data);
+      free (it);
+    }
+}
+
+/*
+ *  blk_run - dispatch every queued request in scheduler order
+ *  @mp: device
+ *
+ *  A swap file only has them submitted, see blk_unplug.
+ */
+static void
+blk_run (struct memphy_struct *mp)
+{
+  struct blk_queue *bq = mp->bq;
+  unsigned long now;
+
+  MEMPHY_lock (mp);
+
+  /* The device starts on the queue once done with the former one */
+  now = blk_now ();
+  if (now < bq->clock)
+    now = bq->clock;
+
+  while (bq->head != NULL)
+    blk_dispatch (mp, blk_pick[bq->sched](bq, now), &now);
+
+  bq->clock = now;
+  MEMPHY_unlock (mp);
+}
+
+/*
+ *  blk_init - put a device behind a request queue
+ *  @mp: device
+ *  @sched: BLK_SCHED_* dispatch policy
+ *  @bandwidth: bytes transferred per time slot
+ *  @latency: ticks per dispatched request
+ */
+int
+blk_init (struct memphy_struct *mp, int sched, unsigned long bandwidth,
+          unsigned long latency)
+{
+  struct blk_queue *bq;
+
+  if (sched < BLK_SCHED_NOOP || sched > BLK_SCHED_SCAN || bandwidth == 0)
+    return -1;
+
+  bq = calloc (1, sizeof (struct blk_queue));
+  bq->sched = sched;
+  bq->bandwidth = bandwidth;
+  bq->latency = latency;
+  bq->dir = 1;
+  mp->bq = bq;
+
+  return 0;
+}
+
+/*
+ *  blk_submit_read - queue the read of a device frame into a memory frame
+ *  @mp: device
+ *  @fpn: frame of the device
+ *  @mem: destination device, random access
+ *  @memfpn: destination frame
+ *
+ *  The destination holds the page once the queue is unplugged.
+ */
+int
+blk_submit_read (struct memphy_struct *mp, int fpn, struct memphy_struct *mem,
+                 int memfpn)
+{
+  struct blk_request *rq;
+  BYTE page[PAGING_MAX_PAGESZ];
+
+  if (mp->bq == NULL)
+    { /* Direct access */
+      if (MEMPHY_read_frame (mp, fpn, page) != 0)
+        return -1;
+      return MEMPHY_write_frame (mem, memfpn, page);
+    }
+
+  MEMPHY_lock (mp);
+  mp->bq->nr_rd++;
+
+  /* Still queued for writing, the page is at hand */
+  rq = blk_find (mp->bq, fpn, 1);
+  if (rq != NULL)
+    {
+      MEMPHY_write_frame (mem, memfpn, rq->data);
+      mp->bq->nr_hit++;
+      MEMPHY_unlock (mp);
+      return 0;
+    }
+
+  rq = malloc (sizeof (struct blk_request));
+  rq->fpn = fpn;
+  rq->wr = 0;
+  rq->data = NULL;
+  rq->mem = mem;
+  rq->memfpn = memfpn;
+  blk_enqueue (mp->bq, rq);
+  MEMPHY_unlock (mp);
+
+  return 0;
+}
+
+/*
+ *  blk_submit_write - queue the write of a page to a device frame
+ *  @mp: device
+ *  @fpn: frame of the device
+ *  @buf: page, copied
+ */
+int
+blk_submit_write (struct memphy_struct *mp, int fpn, const BYTE *buf)
+{
+  struct blk_request *rq;
+  int full;
+
+  if (mp->bq == NULL)
+    return MEMPHY_write_frame (mp, fpn, buf);
+
+  MEMPHY_lock (mp);
+  mp->bq->nr_wr++;
+
+  /* A queued read of the frame must get the former content */
+  if (blk_find (mp->bq, fpn, 0) != NULL)
+    blk_run (mp);
+
+  /* A queued write of the frame is outdated, take its place */
+  rq = blk_find (mp->bq, fpn, 1);
+  if (rq != NULL)
+    {
+      memcpy (rq->data, buf, PAGING_PAGESZ);
+      mp->bq->nr_merged++;
+      MEMPHY_unlock (mp);
+      return 0;
+    }
+
+  rq = malloc (sizeof (struct blk_request));
+  rq->fpn = fpn;
+  rq->wr = 1;
+  rq->data = malloc (PAGING_PAGESZ);
+  memcpy (rq->data, buf, PAGING_PAGESZ);
+  rq->mem = NULL;
+  rq->memfpn = -1;
+  blk_enqueue (mp->bq, rq);
+
+  full = (mp->bq->nr >= PAGING_BLK_QDEPTH);
+  MEMPHY_unlock (mp);
+
+  if (full)
+    blk_unplug (mp);
+
+  return 0;
+}
+
+/*
+ *  blk_read - read a device frame into a memory frame and wait for it
+ *  @mp: device
+ *  @fpn: frame of the device
+ *  @mem: destination device, random access
+ *  @memfpn: destination frame
+ */
+int
+blk_read (struct memphy_struct *mp, int fpn, struct memphy_struct *mem,
+          int memfpn)
+{
+  if (blk_submit_read (mp, fpn, mem, memfpn) != 0)
+    return -1;
+
+  return blk_unplug (mp);
+}
+
+/*
+ *  blk_unplug - dispatch every queued request and wait for the reads
+ *  @mp: device
+ *
+ *  A swap file has the writes land whenever done. Its reads, also those
+ *  dispatched by another unplug, are waited for with the device unlocked.
+ */
+int
+blk_unplug (struct memphy_struct *mp)
+{
+  if (mp->bq == NULL)
+    return 0;
+
+  blk_run (mp);
+
+  if (mp->ring != NULL)
+    uring_wait_reads (mp->ring);
+
+  return 0;
+}
+
+int
+blk_dump (struct memphy_struct *mp, const char *name)
+{
+  struct blk_queue *bq = mp->bq;
+
+  if (bq == NULL)
+    return -1;
+
+  printf ("%s: %s scheduler, %lu reads and %lu writes in %lu requests, "
+          "%lu merged, %lu read from the queue\n",
+          name, blk_sched_name[bq->sched], bq->nr_rd, bq->nr_wr,
+          bq->nr_dispatch, bq->nr_merged, bq->nr_hit);
+  printf ("%s: average latency %.2f slots per read, %.2f per write\n", name,
+          bq->nr_rd > 0 ? (double)bq->rd_wait / bq->nr_rd / PAGING_BLK_TICKS
+                        : 0.0,
+          bq->nr_wr > 0 ? (double)bq->wr_wait / bq->nr_wr / PAGING_BLK_TICKS
+                        : 0.0);
+
+  return 0;
+}
+
+// #endif
@@ -0,0 +1,438 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Free region allocator mm/mm-freerg.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Every free region of an area sits in two treaps at once:
+ *  - one per power of two size class, ordered by size then start address,
+ *    through rg_sleft/rg_sright, for a best fit on allocation
+ *  - one ordered by start address, through rg_left/rg_right, to find the
+ *    neighbours a freed region coalesces with
+ * Both use the priority a region gets when created, a hash of its start
+ * then. A region keeps it when later shrunk from the front, the heap order
+ * does not depend on the keys.
+ */
+
+/*
+ *  freerg_bin - size class of a region size
+ *  @size: region size
+ */
+static int
+freerg_bin (unsigned long size)
+{
+  int bin = 0;
+
+  while (size > 1 && bin < PAGING_FREERG_NBINS - 1)
+    {
+      size >>= 1;
+      bin++;
+    }
+
+  return bin;
+}
+
+/*
+ *  freerg_below - a region comes before a (size, start) key in its bin
+ */
+static int
+freerg_below (struct vm_rg_struct *rg, unsigned long size,
+              unsigned long start)
+{
+  unsigned long rgsz = rg->rg_end - rg->rg_start;
+
+  return rgsz < size || (rgsz == size && rg->rg_start < start);
+}
+
+/*
+ *  freerg_bin_split - split a bin treap by (size, start)
+ *  @t: treap root
+ *  @size: region size
+ *  @start: region start
+ *  @l: return the regions below the key
+ *  @r: return the others
+ */
+static void
+freerg_bin_split (struct vm_rg_struct *t, unsigned long size,
+                  unsigned long start, struct vm_rg_struct **l,
+                  struct vm_rg_struct **r)
+{
+  if (t == NULL)
+    {
+      *l = *r = NULL;
+      return;
+    }
+
+  if (freerg_below (t, size, start))
+    {
+      freerg_bin_split (t->rg_sright, size, start, &t->rg_sright, r);
+      *l = t;
+    }
+  else
+    {
+      freerg_bin_split (t->rg_sleft, size, start, l, &t->rg_sleft);
+      *r = t;
+    }
+}
+
+static struct vm_rg_struct *
+freerg_bin_merge (struct vm_rg_struct *l, struct vm_rg_struct *r)
+{
+  if (l == NULL)
+    return r;
+  if (r == NULL)
+    return l;
+
+  if (l->rg_prio > r->rg_prio)
+    {
+      l->rg_sright = freerg_bin_merge (l->rg_sright, r);
+      return l;
+    }
+
+  r->rg_sleft = freerg_bin_merge (l, r->rg_sleft);
+  return r;
+}
+
+static void
+freerg_bin_add (struct vm_freerg_struct *frg, struct vm_rg_struct *rg)
+{
+  unsigned long size = rg->rg_end - rg->rg_start;
+  int bin = freerg_bin (size);
+  struct vm_rg_struct *l, *r;
+
+  rg->rg_sleft = rg->rg_sright = NULL;
+  freerg_bin_split (frg->bins[bin], size, rg->rg_start, &l, &r);
+  frg->bins[bin] = freerg_bin_merge (freerg_bin_merge (l, rg), r);
+  frg->binmap |= 1u << bin;
+}
+
+static void
+freerg_bin_del (struct vm_freerg_struct *frg, struct vm_rg_struct *rg)
+{
+  unsigned long size = rg->rg_end - rg->rg_start;
+  int bin = freerg_bin (size);
+  struct vm_rg_struct *l, *m, *r;
+
+  freerg_bin_split (frg->bins[bin], size, rg->rg_start, &l, &m);
+  freerg_bin_split (m, size, rg->rg_start + 1, &m, &r);
+  frg->bins[bin] = freerg_bin_merge (l, r);
+
+  if (frg->bins[bin] == NULL)
+    frg->binmap &= ~(1u << bin);
+}
+
+/*
+ *  freerg_bin_fit - smallest region of a bin holding a given size
+ *  @t: bin treap root
+ *  @size: requested size
+ *
+ *  The lowest one among those of that size. Return NULL if none fits.
+ */
+static struct vm_rg_struct *
+freerg_bin_fit (struct vm_rg_struct *t, unsigned long size)
+{
+  struct vm_rg_struct *fit = NULL;
+
+  while (t != NULL)
+    if (t->rg_end - t->rg_start >= size)
+      {
+        fit = t;
+        t = t->rg_sleft;
+      }
+    else
+      t = t->rg_sright;
+
+  return fit;
+}
+
+/*
+ *  freerg_split - split a treap by start address
+ *  @t: treap root
+ *  @key: address
+ *  @l: return the regions starting below key
+ *  @r: return the others
+ */
+static void
+freerg_split (struct vm_rg_struct *t, unsigned long key,
+              struct vm_rg_struct **l, struct vm_rg_struct **r)
+{
+  if (t == NULL)
+    {
+      *l = *r = NULL;
+      return;
+    }
+
+  if (t->rg_start < key)
+    {
+      freerg_split (t->rg_right, key, &t->rg_right, r);
+      *l = t;
+    }
+  else
+    {
+      freerg_split (t->rg_left, key, l, &t->rg_left);
+      *r = t;
+    }
+}
+
+/*
+ *  freerg_merge - join two treaps, every region of l lying below r
+ */
+static struct vm_rg_struct *
+freerg_merge (struct vm_rg_struct *l, struct vm_rg_struct *r)
+{
+  if (l == NULL)
+    return r;
+  if (r == NULL)
+    return l;
+
+  if (l->rg_prio > r->rg_prio)
+    {
+      l->rg_right = freerg_merge (l->rg_right, r);
+      return l;
+    }
+
+  r->rg_left = freerg_merge (l, r->rg_left);
+  return r;
+}
+
+static void
+freerg_tree_add (struct vm_freerg_struct *frg, struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct *l, *r;
+
+  rg->rg_left = rg->rg_right = NULL;
+  freerg_split (frg->root, rg->rg_start, &l, &r);
+  frg->root = freerg_merge (freerg_merge (l, rg), r);
+}
+
+static void
+freerg_tree_del (struct vm_freerg_struct *frg, struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct *l, *m, *r;
+
+  freerg_split (frg->root, rg->rg_start, &l, &m);
+  freerg_split (m, rg->rg_start + 1, &m, &r);
+  frg->root = freerg_merge (l, r);
+}
+
+/*
+ *  freerg_init - set up an empty free region set
+ *  @frg: free region set
+ */
+int
+freerg_init (struct vm_freerg_struct *frg)
+{
+  int bin;
+
+  for (bin = 0; bin < PAGING_FREERG_NBINS; bin++)
+    frg->bins[bin] = NULL;
+  frg->binmap = 0;
+  frg->root = NULL;
+
+  return 0;
+}
+
+/*
+ *  freerg_insert - give a region back, merged with its free neighbours
+ *  @frg: free region set
+ *  @rg_start: region start
+ *  @rg_end: region end
+ *  @retrg: return the whole free region it ends up in, may be NULL
+ *
+ *  A region overlapping free space (double free) is refused.
+ */
+int
+freerg_insert (struct vm_freerg_struct *frg, unsigned long rg_start,
+               unsigned long rg_end, struct vm_rg_struct *retrg)
+{
+  struct vm_rg_struct *pred = NULL, *succ = NULL, *t, *rg;
+
+  if (rg_start >= rg_end)
+    return -1;
+
+  /* Closest free regions below and above */
+  for (t = frg->root; t != NULL;)
+    if (t->rg_start < rg_start)
+      {
+        pred = t;
+        t = t->rg_right;
+      }
+    else
+      {
+        succ = t;
+        t = t->rg_left;
+      }
+
+  if ((pred != NULL && pred->rg_end > rg_start)
+      || (succ != NULL && succ->rg_start < rg_end))
+    return -1;
+
+  if (succ != NULL && succ->rg_start == rg_end)
+    { /* Absorb the following region */
+      rg_end = succ->rg_end;
+      freerg_bin_del (frg, succ);
+      freerg_tree_del (frg, succ);
+      free (succ);
+    }
+
+  if (pred != NULL && pred->rg_end == rg_start)
+    { /* Extend the preceding region, its place in the tree holds */
+      freerg_bin_del (frg, pred);
+      pred->rg_end = rg_end;
+      rg = pred;
+    }
+  else
+    {
+      rg = init_vm_rg (rg_start, rg_end);
+      rg->rg_prio = (unsigned int)rg_start * 2654435761u;
+      freerg_tree_add (frg, rg);
+    }
+
+  freerg_bin_add (frg, rg);
+
+  if (retrg != NULL)
+    {
+      retrg->rg_start = rg->rg_start;
+      retrg->rg_end = rg->rg_end;
+    }
+
+  return 0;
+}
+
+/*
+ *  freerg_alloc - carve a region out of the free space
+ *  @frg: free region set
+ *  @size: requested size
+ *  @newrg: return the region
+ *
+ *  Best fit inside the size class of the request, otherwise in the
+ *  smallest larger class, where everything fits.
+ */
+int
+freerg_alloc (struct vm_freerg_struct *frg, unsigned long size,
+              struct vm_rg_struct *newrg)
+{
+  struct vm_rg_struct *rg;
+  unsigned int map;
+  int bin;
+
+  if (size == 0)
+    return -1;
+
+  bin = freerg_bin (size);
+  rg = freerg_bin_fit (frg->bins[bin], size);
+
+  if (rg == NULL)
+    {
+      map = (bin + 1 < PAGING_FREERG_NBINS) ? frg->binmap >> (bin + 1) : 0;
+      if (map == 0)
+        return -1;
+
+      bin++;
+      while (!(map & 1))
+        {
+          map >>= 1;
+          bin++;
+        }
+      rg = freerg_bin_fit (frg->bins[bin], size);
+    }
+
+  newrg->rg_start = rg->rg_start;
+  newrg->rg_end = rg->rg_start + size;
+
+  freerg_bin_del (frg, rg);
+  if (rg->rg_end - rg->rg_start > size)
+    { /* Keep the tail, its order by address is unchanged */
+      rg->rg_start += size;
+      freerg_bin_add (frg, rg);
+    }
+  else
+    {
+      freerg_tree_del (frg, rg);
+      free (rg);
+    }
+
+  return 0;
+}
+
+static void
+freerg_copy_tree (struct vm_freerg_struct *dst, struct vm_rg_struct *t)
+{
+  if (t == NULL)
+    return;
+
+  freerg_copy_tree (dst, t->rg_left);
+  freerg_insert (dst, t->rg_start, t->rg_end, NULL);
+  freerg_copy_tree (dst, t->rg_right);
+}
+
+/*
+ *  freerg_copy - duplicate a free region set
+ *  @dst: free region set to fill
+ *  @src: free region set copied
+ */
+int
+freerg_copy (struct vm_freerg_struct *dst, struct vm_freerg_struct *src)
+{
+  freerg_init (dst);
+  freerg_copy_tree (dst, src->root);
+
+  return 0;
+}
+
+static void
+freerg_release_tree (struct vm_rg_struct *t)
+{
+  if (t == NULL)
+    return;
+
+  freerg_release_tree (t->rg_left);
+  freerg_release_tree (t->rg_right);
+  free (t);
+}
+
+/*
+ *  freerg_release - free every region of a free region set
+ *  @frg: free region set, left empty
+ */
+int
+freerg_release (struct vm_freerg_struct *frg)
+{
+  freerg_release_tree (frg->root);
+  freerg_init (frg);
+
+  return 0;
+}
+
+static void
+freerg_print_tree (struct vm_rg_struct *t)
+{
+  if (t == NULL)
+    return;
+
+  freerg_print_tree (t->rg_left);
+  printf ("\trg[%ld->%ld]\n", t->rg_start, t->rg_end);
+  freerg_print_tree (t->rg_right);
+}
+
+int
+print_freerg (struct vm_freerg_struct *frg)
+{
+  printf ("\tprint_freerg: ");
+  if (frg->root == NULL)
+    {
+      printf ("NULL list\n");
+      return -1;
+    }
+  printf ("\n");
+  freerg_print_tree (frg->root);
+  printf ("\n");
+  return 0;
+}
+
+// #endif
@@ -0,0 +1,250 @@
+// #ifdef MM_KSM
+/*
+ * PAGING based Memory Management
+ * Same-page merging mm/mm-ksm.c
+ */
+
+#include "mm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Frames holding the same content, in one process or across several, are
+ * merged into a single frame mapped copy-on-write by all of them. Pages
+ * never written share the zero frame from the start. A frame is only a
+ * merge candidate once its checksum has stayed unchanged for a whole scan
+ * period, so that pages still being written are not merged and split back
+ * over and over. Checksums are taken without any lock, a merge locks the
+ * mappers of both frames and compares the contents again.
+ */
+
+/* Statistics */
+static unsigned long ksm_nrmerged;
+static unsigned long ksm_nrzero;
+
+/*
+ *  ksm_checksum - FNV-1a hash of a frame content
+ *  @mram: MEMRAM
+ *  @fpn: frame number
+ */
+static unsigned int
+ksm_checksum (struct memphy_struct *mram, int fpn)
+{
+  unsigned int csum = 2166136261u;
+  BYTE page[PAGING_MAX_PAGESZ];
+  int it;
+
+  MEMPHY_read_frame (mram, fpn, page);
+  for (it = 0; it < PAGING_PAGESZ; it++)
+    csum = (csum ^ (unsigned char)page[it]) * 16777619u;
+
+  return csum;
+}
+
+/*
+ *  ksm_same - compare the content of two frames
+ *  @mram: MEMRAM
+ *  @fpn1: first frame
+ *  @fpn2: second frame
+ */
+static int
+ksm_same (struct memphy_struct *mram, int fpn1, int fpn2)
+{
+  BYTE page1[PAGING_MAX_PAGESZ], page2[PAGING_MAX_PAGESZ];
+
+  MEMPHY_read_frame (mram, fpn1, page1);
+  MEMPHY_read_frame (mram, fpn2, page2);
+
+  return memcmp (page1, page2, PAGING_PAGESZ) == 0;
+}
+
+/*
+ *  ksm_remap - point one mapper of a duplicate frame to the kept frame
+ *  @mram: MEMRAM
+ *  @keep: frame kept
+ *  @mm: mm of the mapper
+ *  @pgn: page number of the mapper
+ */
+static void
+ksm_remap (struct memphy_struct *mram, int keep, struct mm_struct *mm,
+           int pgn)
+{
+  pte_t *pte = pte_ptr (mm, pgn);
+  pte_t dirty = *pte & PAGING_PTE_DIRTY_MASK;
+
+  /* Keep the dirty state, the kept frame swap cache copy may be stale */
+  mm_seq_begin (mm);
+  pte_set_fpn (pte, keep);
+  pte_store (pte, *pte | dirty | PAGING_PTE_COW_MASK);
+  mm_seq_end (mm);
+
+  if (keep != mram->zero_fpn)
+    MEMPHY_add_rmap (mram, keep, mm, pgn);
+  else /* Nothing tracks the zero frame mappers, done with this one */
+    pthread_mutex_unlock (&mm->mm_lock);
+}
+
+/*
+ *  ksm_merge - fold a duplicate frame into an identical one
+ *  @mram: MEMRAM
+ *  @mswp: swap devices, for the duplicate swap cache slot
+ *  @keep: frame kept
+ *  @dup: frame released
+ *
+ *  Return -1 when a mapper of either frame is busy or the contents differ
+ *  by now.
+ */
+static int
+ksm_merge (struct memphy_struct *mram, struct memphy_struct *mswp, int keep,
+           int dup)
+{
+  struct framephy_struct *kfp = &mram->frmtbl[keep];
+  struct framephy_struct *dfp = &mram->frmtbl[dup];
+  struct rmap_struct *rm;
+  pte_t *pte;
+
+  if (frame_trylock_mappers (mram, dup) != 0)
+    return -1;
+
+  if (keep != mram->zero_fpn && frame_trylock_mappers (mram, keep) != 0)
+    {
+      frame_unlock_mappers (mram, dup);
+      return -1;
+    }
+
+  /* With every mapper held, neither frame can be written any more */
+  if (!ksm_same (mram, keep, dup))
+    {
+      if (keep != mram->zero_fpn)
+        frame_unlock_mappers (mram, keep);
+      frame_unlock_mappers (mram, dup);
+      return -1;
+    }
+
+  /* The kept frame becomes read-only for its own mappers as well */
+  if (keep != mram->zero_fpn)
+    {
+      pte = pte_ptr (kfp->owner, kfp->pgn);
+      pte_store (pte, *pte | PAGING_PTE_COW_MASK);
+      for (rm = kfp->rmap_list; rm != NULL; rm = rm->rm_next)
+        {
+          pte = pte_ptr (rm->mm, rm->pgn);
+          pte_store (pte, *pte | PAGING_PTE_COW_MASK);
+        }
+    }
+
+  ksm_remap (mram, keep, dfp->owner, dfp->pgn);
+  for (rm = dfp->rmap_list; rm != NULL; rm = rm->rm_next)
+    ksm_remap (mram, keep, rm->mm, rm->pgn);
+
+  MEMPHY_set_rmap (mram, dup, NULL, -1);
+  put_free_frame (mram, mswp, dup);
+
+  /* The kept frame mappers now include those of the duplicate */
+  if (keep != mram->zero_fpn)
+    frame_unlock_mappers (mram, keep);
+
+  return 0;
+}
+
+/*
+ *  ksm_init - reserve the shared zero frame
+ *  @mram: MEMRAM
+ */
+int
+ksm_init (struct memphy_struct *mram)
+{
+  int fpn;
+
+  if (MEMPHY_get_freefp (mram, &fpn) != 0)
+    return -1;
+
+  MEMPHY_clear_frame (mram, fpn);
+
+  /* Left without owner, replacement never picks it */
+  mram->zero_fpn = fpn;
+
+  return 0;
+}
+
+/*
+ *  ksm_scan - merge the stable frames holding identical content
+ *  @mram: MEMRAM
+ *  @mswp: swap devices
+ *
+ *  Return the number of frames released.
+ */
+int
+ksm_scan (struct memphy_struct *mram, struct memphy_struct *mswp)
+{
+  struct framephy_struct *fp;
+  unsigned int csum, zero_csum;
+  int *htbl, hsz, fpn, slot, nr_merged = 0;
+
+  if (mram->zero_fpn < 0)
+    return 0;
+
+  zero_csum = ksm_checksum (mram, mram->zero_fpn);
+
+  /* Open addressing table of the stable frames seen so far, by checksum */
+  hsz = 2 * mram->maxfpn;
+  htbl = malloc (hsz * sizeof (int));
+  for (slot = 0; slot < hsz; slot++)
+    htbl[slot] = -1;
+
+  for (fpn = 0; fpn < mram->maxfpn; fpn++)
+    {
+      fp = &mram->frmtbl[fpn];
+      if (__atomic_load_n (&fp->owner, __ATOMIC_RELAXED) == NULL
+          || fpn == mram->zero_fpn)
+        continue;
+
+      csum = ksm_checksum (mram, fpn);
+      if (csum != fp->ksm_csum)
+        { /* Changed since the last scan, wait for it to settle */
+          fp->ksm_csum = csum;
+          continue;
+        }
+
+      if (csum == zero_csum && ksm_same (mram, fpn, mram->zero_fpn))
+        {
+          if (ksm_merge (mram, mswp, mram->zero_fpn, fpn) == 0)
+            {
+              ksm_nrzero++;
+              nr_merged++;
+            }
+          continue;
+        }
+
+      for (slot = csum % hsz; htbl[slot] >= 0; slot = (slot + 1) % hsz)
+        if (mram->frmtbl[htbl[slot]].ksm_csum == csum
+            && ksm_same (mram, htbl[slot], fpn))
+          break;
+
+      if (htbl[slot] < 0)
+        {
+          htbl[slot] = fpn;
+          continue;
+        }
+
+      if (ksm_merge (mram, mswp, htbl[slot], fpn) == 0)
+        {
+          ksm_nrmerged++;
+          nr_merged++;
+        }
+    }
+
+  free (htbl);
+
+#ifdef MMDBG
+  if (nr_merged > 0)
+    printf ("\t[KSM] merged %d frames, %lu so far, %lu onto the zero page\n",
+            nr_merged, ksm_nrmerged + ksm_nrzero, ksm_nrzero);
+#endif
+
+  return nr_merged;
+}
+
+// #endif
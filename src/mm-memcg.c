@@ -0,0 +1,156 @@
+// #ifdef MM_MEMCG
+/*
+ * PAGING based Memory Management
+ * Memory control groups mm/mm-memcg.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+
+/*
+ * Every process belongs to a group, the root group 0 unless the config
+ * names another one, and its forked children stay in it. A group is
+ * charged with the MEMRAM frames owned by its members, the ones its reclaim
+ * can evict: a shared frame counts once, for its owner, the zero frame and
+ * huge pages for nobody. Over its hard limit a member only gets a frame by
+ * evicting a page of the group, over its soft limit the group is the first
+ * to lose pages when MEMRAM runs short. The usage is updated under the
+ * MEMRAM lock, read without it, hence the atomics.
+ */
+static struct memcg_struct memcg_tbl[PAGING_MAX_MEMCG];
+
+/*
+ *  memcg_get - group of a given id, the root group if out of range
+ *  @id: group id
+ */
+struct memcg_struct *
+memcg_get (int id)
+{
+  struct memcg_struct *memcg;
+
+  if (id < 0 || id >= PAGING_MAX_MEMCG)
+    id = 0;
+
+  memcg = &memcg_tbl[id];
+  memcg->id = id;
+  memcg->used = 1;
+
+  return memcg;
+}
+
+/*
+ *  memcg_set_limit - set the resident page limits of a group
+ *  @id: group id, the root group has none
+ *  @limit: hard limit in pages, 0 = none
+ *  @soft: soft limit in pages, 0 = none
+ */
+int
+memcg_set_limit (int id, int limit, int soft)
+{
+  if (id <= 0 || id >= PAGING_MAX_MEMCG || limit < 0 || soft < 0)
+    return -1;
+
+  memcg_tbl[id].limit = limit;
+  memcg_tbl[id].soft = soft;
+
+  return 0;
+}
+
+/*
+ *  memcg_charge - account pages mapped or unmapped by a member
+ *  @memcg: group
+ *  @nr: pages, negative when unmapped
+ */
+void
+memcg_charge (struct memcg_struct *memcg, int nr)
+{
+  if (memcg != NULL)
+    __atomic_fetch_add (&memcg->usage, nr, __ATOMIC_RELAXED);
+}
+
+/*
+ *  memcg_over - would more pages take a group over its hard limit
+ *  @memcg: group
+ *  @nr: pages to be mapped
+ */
+int
+memcg_over (struct memcg_struct *memcg, int nr)
+{
+  return memcg != NULL && memcg->limit > 0
+         && __atomic_load_n (&memcg->usage, __ATOMIC_RELAXED) + nr
+                > memcg->limit;
+}
+
+/*
+ *  memcg_soft_excess - group the furthest over its soft limit
+ *
+ *  Return NULL when every group is within its soft limit.
+ */
+struct memcg_struct *
+memcg_soft_excess (void)
+{
+  struct memcg_struct *worst = NULL;
+  int id, excess, most = 0;
+
+  for (id = 1; id < PAGING_MAX_MEMCG; id++)
+    {
+      if (memcg_tbl[id].soft == 0)
+        continue;
+
+      excess = __atomic_load_n (&memcg_tbl[id].usage, __ATOMIC_RELAXED)
+               - memcg_tbl[id].soft;
+      if (excess > most)
+        {
+          most = excess;
+          worst = &memcg_tbl[id];
+        }
+    }
+
+  return worst;
+}
+
+/*
+ *  memcg_reclaim - evict a page of a group
+ *  @mram: MEMRAM
+ *  @mswp: swap devices
+ *  @memcg: group losing the page
+ *  @retfpn: return the MEMRAM frame released
+ *
+ *  Same return as swap_out_page.
+ */
+int
+memcg_reclaim (struct memphy_struct *mram, struct memphy_struct *mswp,
+               struct memcg_struct *memcg, int *retfpn)
+{
+  int ret = swap_out_page (mram, mswp, memcg, retfpn);
+
+  if (ret == 0)
+    __atomic_fetch_add (&memcg->nr_reclaim, 1, __ATOMIC_RELAXED);
+
+  return ret;
+}
+
+int
+memcg_dump (void)
+{
+  struct memcg_struct *memcg;
+  int id;
+
+  for (id = 0; id < PAGING_MAX_MEMCG; id++)
+    {
+      memcg = &memcg_tbl[id];
+      if (!memcg->used)
+        continue;
+
+      printf ("MEMCG%d: %d pages (limit %d, soft %d), %lu faults, "
+              "%lu swapped in, %lu swapped out, %lu reclaimed, "
+              "%lu over limit\n",
+              id, memcg->usage, memcg->limit, memcg->soft, memcg->nr_fault,
+              memcg->nr_swapin, memcg->nr_swapout, memcg->nr_reclaim,
+              memcg->nr_overlimit);
+    }
+
+  return 0;
+}
+
+// #endif
@@ -5,29 +5,82 @@
  */
 
 #include "mm.h"
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-/* Lock for the whole memphy space */
+/*
+ * Every device has its own lock, held only while its free list or frame
+ * table entries are updated. It is recursive since the composed operations
+ * below call each other. Page contents are copied without it, the frames
+ * involved being owned by the caller at that point.
+ */
+
+/*
+ *  MEMPHY_lock - lock the frame table of a device
+ *  @mp: memphy struct
+ */
+void
+MEMPHY_lock (struct memphy_struct *mp)
+{
+  pthread_mutex_lock (&mp->lock);
+}
+
+void
+MEMPHY_unlock (struct memphy_struct *mp)
+{
+  pthread_mutex_unlock (&mp->lock);
+}
+
+/* Seek latency run up by the calling thread, see MEMPHY_take_stall */
+static __thread int memphy_stall;
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  The head travels from where the last access left it, the distance is
+ *  charged as seek latency to the thread doing the access. Return the
+ *  latency in time slots.
  */
 int
-MEMPHY_mv_csr (struct memphy_struct *mp, int offset)
+MEMPHY_mv_csr (struct memphy_struct *mp, addr_t offset)
 {
-  int numstep = 0;
+  addr_t dist;
+  int cost;
 
-  mp->cursor = 0;
-  while (numstep < offset && numstep < mp->maxsz)
-    {
-      /* Traverse sequentially */
-      mp->cursor = (mp->cursor + 1) % mp->maxsz;
-      numstep++;
-    }
+  if (offset > mp->maxsz)
+    return -1;
 
-  return 0;
+  dist = (offset > mp->cursor) ? offset - mp->cursor : mp->cursor - offset;
+  cost = DIV_ROUND_UP (dist, PAGING_SEEK_SLOTSZ);
+
+  mp->cursor = offset;
+  mp->seek_dist += dist;
+  mp->seek_slots += cost;
+  memphy_stall += cost;
+
+  return cost;
+}
+
+/*
+ *  MEMPHY_take_stall - collect the seek latency of the calling thread
+ *
+ *  A CPU running a process charges it to the process, which then waits
+ *  that many time slots as if blocked on the device. Return the latency in
+ *  time slots run up since the last call.
+ */
+int
+MEMPHY_take_stall (void)
+{
+  int stall = memphy_stall;
+
+  memphy_stall = 0;
+
+  return stall;
 }
 
 /*
@@ -37,18 +90,23 @@ MEMPHY_mv_csr (struct memphy_struct *mp, int offset)
  *  @value: obtained value
  */
 int
-MEMPHY_seq_read (struct memphy_struct *mp, int addr, BYTE *value)
+MEMPHY_seq_read (struct memphy_struct *mp, addr_t addr, BYTE *value)
 {
   if (mp == NULL)
     return -1;
 
-  if (!mp->rdmflg)
+  if (mp->rdmflg || addr >= mp->maxsz)
     {
       return -1; /* Not compatible mode for sequential read */
     }
 
+  /* The cursor is shared by every user of the device */
+  MEMPHY_lock (mp);
   MEMPHY_mv_csr (mp, addr);
   *value = (BYTE)mp->storage[addr];
+  mp->cursor++;
+  MEMPHY_unlock (mp);
+
   return 0;
 }
 
@@ -59,7 +117,7 @@ MEMPHY_seq_read (struct memphy_struct *mp, int addr, BYTE *value)
  *  @value: obtained value
  */
 int
-MEMPHY_read (struct memphy_struct *mp, int addr, BYTE *value)
+MEMPHY_read (struct memphy_struct *mp, addr_t addr, BYTE *value)
 {
   if (mp == NULL)
     return -1;
@@ -81,18 +139,21 @@ MEMPHY_read (struct memphy_struct *mp, int addr, BYTE *value)
  *  @data: written data
  */
 int
-MEMPHY_seq_write (struct memphy_struct *mp, int addr, BYTE value)
+MEMPHY_seq_write (struct memphy_struct *mp, addr_t addr, BYTE value)
 {
 
   if (mp == NULL)
     return -1;
-  if (!mp->rdmflg)
+  if (mp->rdmflg || addr >= mp->maxsz)
     {
-      return -1; /* Not compatible mode for sequential read */
+      return -1; /* Not compatible mode for sequential write */
     }
 
+  MEMPHY_lock (mp);
   MEMPHY_mv_csr (mp, addr);
   mp->storage[addr] = value;
+  mp->cursor++;
+  MEMPHY_unlock (mp);
 
   return 0;
 }
@@ -104,7 +165,7 @@ MEMPHY_seq_write (struct memphy_struct *mp, int addr, BYTE value)
  *  @data: written data
  */
 int
-MEMPHY_write (struct memphy_struct *mp, int addr, BYTE data)
+MEMPHY_write (struct memphy_struct *mp, addr_t addr, BYTE data)
 {
   if (mp == NULL)
     return -1;
@@ -119,6 +180,104 @@ MEMPHY_write (struct memphy_struct *mp, int addr, BYTE data)
   return 0;
 }
 
+/*
+ *  MEMPHY_frame_ok - check a whole frame lies inside the device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+static int
+MEMPHY_frame_ok (struct memphy_struct *mp, int fpn)
+{
+  return mp != NULL && fpn >= 0
+         && PAGING_FRAME_ADDR (fpn) + PAGING_PAGESZ <= mp->maxsz;
+}
+
+/*
+ *  MEMPHY_seq_xfer_frame - stream a frame through the cursor
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: page buffer
+ *  @wr: write buf to the frame instead of reading it
+ *
+ *  One seek to the frame start, the cursor then runs along the page. Only
+ *  the cursor needs the device lock, the frame belongs to the caller and
+ *  is copied without it, as on a random access device.
+ */
+static void
+MEMPHY_seq_xfer_frame (struct memphy_struct *mp, int fpn, BYTE *buf, int wr)
+{
+  addr_t addr = PAGING_FRAME_ADDR (fpn);
+
+  MEMPHY_lock (mp);
+  MEMPHY_mv_csr (mp, addr);
+  mp->cursor = addr + PAGING_PAGESZ;
+  MEMPHY_unlock (mp);
+
+  if (wr)
+    memcpy (mp->storage + addr, buf, PAGING_PAGESZ);
+  else
+    memcpy (buf, mp->storage + addr, PAGING_PAGESZ);
+}
+
+/*
+ *  MEMPHY_read_frame - read a whole frame of a MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: page buffer, PAGING_PAGESZ bytes
+ */
+int
+MEMPHY_read_frame (struct memphy_struct *mp, int fpn, BYTE *buf)
+{
+  if (!MEMPHY_frame_ok (mp, fpn))
+    return -1;
+
+  if (mp->ring != NULL) /* Swap file, the ring has its own lock */
+    return uring_rw (mp->ring, fpn, buf, 0);
+
+  if (mp->rdmflg)
+    memcpy (buf, mp->storage + PAGING_FRAME_ADDR (fpn), PAGING_PAGESZ);
+  else /* Sequential access device */
+    MEMPHY_seq_xfer_frame (mp, fpn, buf, 0);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_write_frame - write a whole frame of a MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: page buffer, PAGING_PAGESZ bytes
+ */
+int
+MEMPHY_write_frame (struct memphy_struct *mp, int fpn, const BYTE *buf)
+{
+  if (!MEMPHY_frame_ok (mp, fpn))
+    return -1;
+
+  if (mp->ring != NULL) /* Swap file, the ring has its own lock */
+    return uring_rw (mp->ring, fpn, (BYTE *)buf, 1);
+
+  if (mp->rdmflg)
+    memcpy (mp->storage + PAGING_FRAME_ADDR (fpn), buf, PAGING_PAGESZ);
+  else /* Sequential access device */
+    MEMPHY_seq_xfer_frame (mp, fpn, (BYTE *)buf, 1);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_clear_frame - zero fill a frame of a MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int
+MEMPHY_clear_frame (struct memphy_struct *mp, int fpn)
+{
+  BYTE zero[PAGING_MAX_PAGESZ] = { 0 };
+
+  return MEMPHY_write_frame (mp, fpn, zero);
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
@@ -128,51 +287,226 @@ MEMPHY_format (struct memphy_struct *mp, int pagesz)
 {
   /* This setting come with fixed constant PAGESZ */
   int numfp = mp->maxsz / pagesz;
-  struct framephy_struct *newfst, *fst;
-  int iter = 1;
+  int iter;
+
+  for (iter = 0; iter < PAGING_MAX_NODES; iter++)
+    {
+      mp->free_fp_list[iter] = NULL;
+      mp->node_free[iter] = 0;
+    }
+  mp->used_fp_list = NULL;
+  mp->frmtbl = NULL;
+  mp->maxfpn = 0;
+  mp->free_fpcnt = 0;
+  mp->nr_nodes = 1;
+  mp->remote_lat = PAGING_NUMA_REMOTE_LAT;
+  mp->node_span = (numfp > 0) ? numfp : 1;
+  mp->nr_local = mp->nr_remote = mp->nr_migrated = 0;
+  mp->nr_majflt = 0;
+  mp->clock_hand = 0;
+  mp->cluster_next = 0;
+  mp->zero_fpn = -1;
+  mp->memcg_acct = 0;
+  mp->nr_rdpg = mp->nr_wrpg = 0;
+  mp->seek_dist = mp->seek_slots = 0;
 
   if (numfp <= 0)
     return -1;
 
-  /* Init head of free framephy list */
-  fst = malloc (sizeof (struct framephy_struct));
-  fst->fpn = iter;
-  mp->free_fp_list = fst;
+  /* The frame table owns one node per frame, they are chained in the free
+   * list while unused so getting and putting a frame never allocates */
+  mp->frmtbl = calloc (numfp, sizeof (struct framephy_struct));
+  mp->maxfpn = numfp;
 
-  /* We have list with first element, fill in the rest num-1 element member*/
-  for (iter = 2; iter <= numfp; iter++)
+  /* Frames are numbered from 0 so they fit in [0, maxsz) of the storage */
+  for (iter = numfp - 1; iter >= 0; iter--)
     {
-      newfst = malloc (sizeof (struct framephy_struct));
-      newfst->fpn = iter;
-      newfst->fp_next = NULL;
-      fst->fp_next = newfst;
-      fst = newfst;
+      mp->frmtbl[iter].fpn = iter;
+      MEMPHY_put_freefp (mp, iter);
     }
 
-  mp->used_fp_list = NULL;
+  return 0;
+}
+
+/*
+ *  MEMPHY_node - NUMA node of a frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int
+MEMPHY_node (struct memphy_struct *mp, int fpn)
+{
+  int node = fpn / mp->node_span;
+
+  return (node < mp->nr_nodes) ? node : mp->nr_nodes - 1;
+}
+
+/*
+ *  MEMPHY_set_nodes - split the frames of a device in NUMA nodes
+ *  @mp: memphy struct, no frame taken yet
+ *  @nr_nodes: number of nodes
+ *  @remote_lat: latency of an access from another node
+ */
+int
+MEMPHY_set_nodes (struct memphy_struct *mp, int nr_nodes, int remote_lat)
+{
+  int iter;
+
+  if (nr_nodes < 1 || nr_nodes > PAGING_MAX_NODES || nr_nodes > mp->maxfpn
+      || mp->free_fpcnt != mp->maxfpn)
+    return -1;
+
+  /* Chain the frames again, every one in the list of its node */
+  MEMPHY_lock (mp);
+  for (iter = 0; iter < PAGING_MAX_NODES; iter++)
+    {
+      mp->free_fp_list[iter] = NULL;
+      mp->node_free[iter] = 0;
+    }
+  mp->nr_nodes = nr_nodes;
+  mp->node_span = mp->maxfpn / nr_nodes;
+  mp->remote_lat = remote_lat;
+  mp->free_fpcnt = 0;
+
+  for (iter = mp->maxfpn - 1; iter >= 0; iter--)
+    {
+      mp->frmtbl[iter].isfree = 0;
+      MEMPHY_put_freefp (mp, iter);
+    }
+  MEMPHY_unlock (mp);
 
   return 0;
 }
 
+/*
+ *  MEMPHY_unlink_freefp - take a frame node out of the free list
+ *  @mp: memphy struct
+ *  @fp: frame node, must be free
+ */
+static void
+MEMPHY_unlink_freefp (struct memphy_struct *mp, struct framephy_struct *fp)
+{
+  int node = MEMPHY_node (mp, fp->fpn);
+
+  if (fp->fp_prev != NULL)
+    fp->fp_prev->fp_next = fp->fp_next;
+  else
+    mp->free_fp_list[node] = fp->fp_next;
+
+  if (fp->fp_next != NULL)
+    fp->fp_next->fp_prev = fp->fp_prev;
+
+  fp->fp_next = fp->fp_prev = NULL;
+  fp->isfree = 0;
+  mp->free_fpcnt--;
+  mp->node_free[node]--;
+}
+
+/*
+ *  MEMPHY_get_freefp_node - get a free frame of one node
+ *  @mp: memphy struct
+ *  @node: NUMA node
+ *  @retfpn: return the frame
+ */
 int
-MEMPHY_get_freefp (struct memphy_struct *mp, int *retfpn)
+MEMPHY_get_freefp_node (struct memphy_struct *mp, int node, int *retfpn)
 {
-  struct framephy_struct *fp = mp->free_fp_list;
+  struct framephy_struct *fp;
 
-  if (fp == NULL)
+  if (node < 0 || node >= mp->nr_nodes)
     return -1;
 
-  *retfpn = fp->fpn;
-  mp->free_fp_list = fp->fp_next;
+  MEMPHY_lock (mp);
+  fp = mp->free_fp_list[node];
+  if (fp == NULL)
+    {
+      MEMPHY_unlock (mp);
+      return -1;
+    }
 
-  /* MEMPHY is iteratively used up until its exhausted
-   * No garbage collector acting then it not been released
-   */
-  free (fp);
+  *retfpn = fp->fpn;
+  MEMPHY_unlink_freefp (mp, fp);
+  MEMPHY_unlock (mp);
 
   return 0;
 }
 
+/*
+ *  MEMPHY_get_freefp_near - get a free frame, preferably of one node
+ *  @mp: memphy struct
+ *  @node: preferred NUMA node, the following ones are tried next
+ *  @retfpn: return the frame
+ */
+int
+MEMPHY_get_freefp_near (struct memphy_struct *mp, int node, int *retfpn)
+{
+  int it;
+
+  for (it = 0; it < mp->nr_nodes; it++)
+    if (MEMPHY_get_freefp_node (mp, (node + it) % mp->nr_nodes, retfpn) == 0)
+      return 0;
+
+  return -1;
+}
+
+int
+MEMPHY_get_freefp (struct memphy_struct *mp, int *retfpn)
+{
+  return MEMPHY_get_freefp_near (mp, 0, retfpn);
+}
+
+/*
+ *  MEMPHY_get_freefp_range - get a run of contiguous free frames
+ *  @mp: memphy struct
+ *  @num: number of frames
+ *  @retfpn: return the first frame of the run
+ *
+ *  The search starts where the last run ended so consecutive clusters are
+ *  laid out one after another on the device.
+ */
+int
+MEMPHY_get_freefp_range (struct memphy_struct *mp, int num, int *retfpn)
+{
+  int scan, start, it;
+
+  MEMPHY_lock (mp);
+  if (num <= 0 || num > mp->free_fpcnt)
+    {
+      MEMPHY_unlock (mp);
+      return -1;
+    }
+
+  start = mp->cluster_next;
+  for (scan = 0; scan < mp->maxfpn; scan++, start++)
+    {
+      if (start + num > mp->maxfpn)
+        start = 0;
+
+      for (it = 0; it < num; it++)
+        if (!mp->frmtbl[start + it].isfree)
+          break;
+
+      if (it < num)
+        { /* Skip past the busy frame */
+          start += it;
+          scan += it;
+          continue;
+        }
+
+      for (it = 0; it < num; it++)
+        MEMPHY_unlink_freefp (mp, &mp->frmtbl[start + it]);
+
+      mp->cluster_next = (start + num) % mp->maxfpn;
+      *retfpn = start;
+      MEMPHY_unlock (mp);
+
+      return 0;
+    }
+
+  MEMPHY_unlock (mp);
+  return -1;
+}
+
 int
 MEMPHY_dump (struct memphy_struct *mp)
 {
@@ -185,35 +519,328 @@ MEMPHY_dump (struct memphy_struct *mp)
   return 0;
 }
 
+/*
+ *  MEMPHY_set_owner - change the owner of a frame, locked
+ *  @mp: memphy struct
+ *  @fp: frame
+ *  @owner: new owner, NULL when the frame is released or only shared
+ *
+ *  A MEMRAM frame is charged to the group of its owner, the one its
+ *  replacement evicts the page of. Frames without owner, the zero frame,
+ *  huge pages and frames on their way back to the free list, are charged to
+ *  nobody as no group could reclaim them.
+ */
+static void
+MEMPHY_set_owner (struct memphy_struct *mp, struct framephy_struct *fp,
+                  struct mm_struct *owner)
+{
+#ifdef MM_MEMCG
+  if (mp->memcg_acct && fp->owner != owner)
+    {
+      if (fp->owner != NULL)
+        memcg_charge (fp->owner->memcg, -1);
+      if (owner != NULL)
+        memcg_charge (owner->memcg, 1);
+    }
+#endif
+  __atomic_store_n (&fp->owner, owner, __ATOMIC_RELAXED);
+}
+
 int
 MEMPHY_put_freefp (struct memphy_struct *mp, int fpn)
 {
-  struct framephy_struct *fp = mp->free_fp_list;
-  struct framephy_struct *newnode = malloc (sizeof (struct framephy_struct));
+  struct framephy_struct *fp;
+  int node;
 
-  /* Create new node with value fpn */
-  newnode->fpn = fpn;
-  newnode->fp_next = fp;
-  mp->free_fp_list = newnode;
+  MEMPHY_lock (mp);
+  if (fpn < 0 || fpn >= mp->maxfpn || mp->frmtbl[fpn].isfree)
+    {
+      MEMPHY_unlock (mp);
+      return -1;
+    }
+
+  /* Drop the reverse map and chain the node back to the free list */
+  fp = &mp->frmtbl[fpn];
+  node = MEMPHY_node (mp, fpn);
+  MEMPHY_set_owner (mp, fp, NULL);
+  fp->pgn = -1;
+  __atomic_store_n (&fp->refbit, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&fp->heat, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&fp->rabit, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&fp->remote, 0, __ATOMIC_RELAXED);
+  fp->swpoff = -1;
+  fp->mapcount = 0;
+  fp->isfree = 1;
+  fp->fp_prev = NULL;
+  fp->fp_next = mp->free_fp_list[node];
+  if (fp->fp_next != NULL)
+    fp->fp_next->fp_prev = fp;
+  mp->free_fp_list[node] = fp;
+  mp->free_fpcnt++;
+  mp->node_free[node]++;
+  MEMPHY_unlock (mp);
 
   return 0;
 }
 
 /*
- *  Init MEMPHY struct
+ *  MEMPHY_set_rmap - record which page is mapped onto a frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @owner: mm mapping the frame, NULL drops every mapper
+ *  @pgn: page number inside owner
  */
 int
-init_memphy (struct memphy_struct *mp, int max_size, int randomflg)
+MEMPHY_set_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *owner,
+                 int pgn)
 {
-  mp->storage = (BYTE *)malloc (max_size * sizeof (BYTE));
+  struct framephy_struct *fp;
+  struct rmap_struct *rm;
+
+  if (fpn < 0 || fpn >= mp->maxfpn)
+    return -1;
+
+  MEMPHY_lock (mp);
+  fp = &mp->frmtbl[fpn];
+  while (fp->rmap_list != NULL)
+    {
+      rm = fp->rmap_list;
+      fp->rmap_list = rm->rm_next;
+      free (rm);
+    }
+
+  MEMPHY_set_owner (mp, fp, owner);
+  fp->pgn = pgn;
+  __atomic_store_n (&fp->refbit, 1, __ATOMIC_RELAXED);
+  fp->mapcount = (owner != NULL) ? 1 : 0;
+  MEMPHY_unlock (mp);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_add_rmap - add one more mapper to a shared frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @mm: mm mapping the frame
+ *  @pgn: page number inside mm
+ */
+int
+MEMPHY_add_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *mm,
+                 int pgn)
+{
+  struct framephy_struct *fp;
+  struct rmap_struct *rm;
+
+  if (fpn < 0 || fpn >= mp->maxfpn)
+    return -1;
+
+  MEMPHY_lock (mp);
+  fp = &mp->frmtbl[fpn];
+  if (fp->owner == NULL)
+    {
+      MEMPHY_set_rmap (mp, fpn, mm, pgn);
+      MEMPHY_unlock (mp);
+      return 0;
+    }
+
+  rm = malloc (sizeof (struct rmap_struct));
+  rm->mm = mm;
+  rm->pgn = pgn;
+  rm->rm_next = fp->rmap_list;
+  fp->rmap_list = rm;
+  fp->mapcount++;
+  MEMPHY_unlock (mp);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_del_rmap - remove a mapper of a frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @mm: mm unmapping the frame
+ *  @pgn: page number inside mm
+ *
+ *  Return the number of mappers left.
+ */
+int
+MEMPHY_del_rmap (struct memphy_struct *mp, int fpn, struct mm_struct *mm,
+                 int pgn)
+{
+  struct framephy_struct *fp;
+  struct rmap_struct **rmp, *rm;
+  int mapcount;
+
+  if (fpn < 0 || fpn >= mp->maxfpn)
+    return -1;
+
+  MEMPHY_lock (mp);
+  fp = &mp->frmtbl[fpn];
+  if (fp->owner == mm && fp->pgn == pgn)
+    { /* Promote the next mapper to owner */
+      rm = fp->rmap_list;
+      if (rm == NULL)
+        {
+          MEMPHY_set_owner (mp, fp, NULL);
+          fp->pgn = -1;
+          fp->mapcount = 0;
+        }
+      else
+        {
+          MEMPHY_set_owner (mp, fp, rm->mm);
+          fp->pgn = rm->pgn;
+          fp->rmap_list = rm->rm_next;
+          free (rm);
+          fp->mapcount--;
+        }
+    }
+  else
+    {
+      for (rmp = &fp->rmap_list; *rmp != NULL; rmp = &(*rmp)->rm_next)
+        if ((*rmp)->mm == mm && (*rmp)->pgn == pgn)
+          {
+            rm = *rmp;
+            *rmp = rm->rm_next;
+            free (rm);
+            fp->mapcount--;
+            break;
+          }
+    }
+
+  mapcount = fp->mapcount;
+  MEMPHY_unlock (mp);
+
+  return mapcount;
+}
+
+/*
+ *  MEMPHY_setup - set up a device around its storage
+ *  @mp: memphy struct, storage and fd already set
+ *  @max_size: device size
+ *  @randomflg: random access device
+ */
+static void
+MEMPHY_setup (struct memphy_struct *mp, addr_t max_size, int randomflg)
+{
+  pthread_mutexattr_t attr;
+
   mp->maxsz = max_size;
 
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&mp->lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+
   MEMPHY_format (mp, PAGING_PAGESZ);
 
   mp->rdmflg = (randomflg != 0) ? 1 : 0;
 
-  if (!mp->rdmflg) /* Not Ramdom acess device, then it serial device*/
-    mp->cursor = 0;
+  /* Not Ramdom acess device, then it serial device, head at the start */
+  mp->cursor = 0;
+
+  /* Accessed directly until put behind a request queue */
+  mp->bq = NULL;
+}
+
+/*
+ *  Init MEMPHY struct
+ */
+int
+init_memphy (struct memphy_struct *mp, addr_t max_size, int randomflg)
+{
+  mp->storage = (BYTE *)malloc (max_size * sizeof (BYTE));
+  mp->fd = -1;
+  mp->ring = NULL;
+
+  MEMPHY_setup (mp, max_size, randomflg);
+
+  return 0;
+}
+
+/*
+ *  init_memphy_file - init a MEMPHY struct stored in a file
+ *  @mp: memphy struct
+ *  @max_size: device size
+ *  @randomflg: random access device
+ *  @path: backing file, created if missing
+ *
+ *  The file is mapped shared and sized without writing it, so frames never
+ *  touched take no host memory nor disk blocks, and the content written is
+ *  still there on the next run. The frame table starts empty every run.
+ *  With MM_SWAP_URING the file is read and written through an io_uring
+ *  instead of being mapped.
+ */
+int
+init_memphy_file (struct memphy_struct *mp, addr_t max_size, int randomflg,
+                  const char *path)
+{
+  void *storage;
+  int fd;
+
+  if (max_size == 0)
+    return init_memphy (mp, max_size, randomflg);
+
+#ifdef MM_SWAP_URING
+  /* Transfers go through the file, nothing is mapped */
+  mp->ring = uring_open (path, max_size);
+  if (mp->ring == NULL)
+    return -1;
+
+  mp->storage = NULL;
+  mp->fd = -1;
+  MEMPHY_setup (mp, max_size, randomflg);
+
+  return 0;
+#endif
+
+  fd = open (path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return -1;
+
+  if (ftruncate (fd, max_size) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  storage = mmap (NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (storage == MAP_FAILED)
+    {
+      close (fd);
+      return -1;
+    }
+
+  mp->storage = (BYTE *)storage;
+  mp->fd = fd;
+  mp->ring = NULL;
+
+  MEMPHY_setup (mp, max_size, randomflg);
+
+  return 0;
+}
+
+/*
+ *  MEMPHY_release - give back the storage of a device
+ *  @mp: memphy struct
+ */
+int
+MEMPHY_release (struct memphy_struct *mp)
+{
+  if (mp->ring != NULL)
+    {
+      uring_close (mp->ring);
+      mp->ring = NULL;
+    }
+  else if (mp->fd < 0)
+    free (mp->storage);
+  else
+    {
+      munmap (mp->storage, mp->maxsz);
+      close (mp->fd);
+      mp->fd = -1;
+    }
+  mp->storage = NULL;
 
   return 0;
 }
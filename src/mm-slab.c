@@ -0,0 +1,198 @@
+// #ifdef MM_SLAB
+/*
+ * PAGING based Memory Management
+ * Small region packing mm/mm-slab.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Small requests are rounded up to a power of two size class and packed
+ * into slabs, page sized chunks of virtual space split in objects of one
+ * class. A new chunk is only taken from the area once every slab of the
+ * class is full, and goes back to the free regions once its last object is
+ * freed.
+ */
+
+/*
+ *  slab_class - size class serving a request
+ *  @size: requested size
+ */
+static int
+slab_class (int size)
+{
+  int cls = 0;
+
+  while ((PAGING_SLAB_MINSZ << cls) < size)
+    cls++;
+
+  return cls;
+}
+
+static struct vm_slab_struct *
+slab_create (unsigned long start, int objsz)
+{
+  struct vm_slab_struct *sl = malloc (sizeof (struct vm_slab_struct));
+
+  sl->sl_start = start;
+  sl->sl_objsz = objsz;
+  sl->sl_nrobj = PAGING_PAGESZ / objsz;
+  sl->sl_nrfree = sl->sl_nrobj;
+  sl->sl_used = calloc (sl->sl_nrobj, sizeof (BYTE));
+  sl->sl_next = NULL;
+
+  return sl;
+}
+
+/*
+ *  slab_alloc - get a small region out of a slab
+ *  @caller: caller
+ *  @vmaid: ID vm area to alloc memory region
+ *  @size: requested size, up to PAGING_SLAB_MAXSZ
+ *  @newrg: return the region
+ */
+int
+slab_alloc (struct pcb_t *caller, int vmaid, int size,
+            struct vm_rg_struct *newrg)
+{
+  struct vm_slab_struct *sl;
+  struct vm_rg_struct chunk;
+  int cls, obj;
+
+  if (size <= 0 || size > PAGING_SLAB_MAXSZ)
+    return -1;
+
+  cls = slab_class (size);
+  for (sl = caller->mm->slabs[cls]; sl != NULL; sl = sl->sl_next)
+    if (sl->sl_nrfree > 0)
+      break;
+
+  if (sl == NULL)
+    { /* Every slab of the class is full, carve a new one */
+      if (vm_alloc_rg (caller, vmaid, PAGING_PAGESZ, &chunk) != 0)
+        return -1;
+
+      sl = slab_create (chunk.rg_start, PAGING_SLAB_MINSZ << cls);
+      sl->sl_next = caller->mm->slabs[cls];
+      caller->mm->slabs[cls] = sl;
+    }
+
+  for (obj = 0; sl->sl_used[obj]; obj++)
+    ;
+
+  sl->sl_used[obj] = 1;
+  sl->sl_nrfree--;
+
+  newrg->rg_start = sl->sl_start + obj * sl->sl_objsz;
+  newrg->rg_end = newrg->rg_start + size;
+
+#ifdef MMDBG
+  printf ("\t[SLAB] PID=%d object %d of slab %lu size %d\n", caller->pid, obj,
+          sl->sl_start, sl->sl_objsz);
+#endif
+
+  return 0;
+}
+
+/*
+ *  slab_free - give a small region back to its slab
+ *  @mm: memory region
+ *  @rg: region freed, return the slab chunk once it is empty
+ *
+ *  Return -1 if the region is not a slab object, 0 when the slab is still
+ *  in use and 1 when the chunk in rg has to be freed.
+ */
+int
+slab_free (struct mm_struct *mm, struct vm_rg_struct *rg)
+{
+  struct vm_slab_struct **slp, *sl;
+  int size = rg->rg_end - rg->rg_start;
+  int obj;
+
+  if (size <= 0 || size > PAGING_SLAB_MAXSZ)
+    return -1;
+
+  for (slp = &mm->slabs[slab_class (size)]; *slp != NULL;
+       slp = &(*slp)->sl_next)
+    {
+      sl = *slp;
+      if (rg->rg_start < sl->sl_start
+          || rg->rg_start >= sl->sl_start + sl->sl_nrobj * sl->sl_objsz)
+        continue;
+
+      obj = (rg->rg_start - sl->sl_start) / sl->sl_objsz;
+      if (!sl->sl_used[obj])
+        return 0; /* Already freed */
+
+      sl->sl_used[obj] = 0;
+      if (++sl->sl_nrfree < sl->sl_nrobj)
+        return 0;
+
+      /* Last object gone, the chunk returns to the area */
+      rg->rg_start = sl->sl_start;
+      rg->rg_end = sl->sl_start + PAGING_PAGESZ;
+
+      *slp = sl->sl_next;
+      free (sl->sl_used);
+      free (sl);
+
+      return 1;
+    }
+
+  return -1;
+}
+
+/*
+ *  slab_copy - duplicate the slabs of an address space
+ *  @newmm: mm receiving the copy
+ *  @mm: mm copied
+ */
+int
+slab_copy (struct mm_struct *newmm, struct mm_struct *mm)
+{
+  struct vm_slab_struct *sl, *newsl, **tail;
+  int cls, obj;
+
+  for (cls = 0; cls < PAGING_SLAB_NCLASS; cls++)
+    {
+      tail = &newmm->slabs[cls];
+      for (sl = mm->slabs[cls]; sl != NULL; sl = sl->sl_next)
+        {
+          newsl = slab_create (sl->sl_start, sl->sl_objsz);
+          for (obj = 0; obj < sl->sl_nrobj; obj++)
+            newsl->sl_used[obj] = sl->sl_used[obj];
+          newsl->sl_nrfree = sl->sl_nrfree;
+
+          *tail = newsl;
+          tail = &newsl->sl_next;
+        }
+      *tail = NULL;
+    }
+
+  return 0;
+}
+
+/*
+ *  slab_release - free the slabs of an address space
+ *  @mm: mm losing its slabs
+ */
+int
+slab_release (struct mm_struct *mm)
+{
+  struct vm_slab_struct *sl;
+  int cls;
+
+  for (cls = 0; cls < PAGING_SLAB_NCLASS; cls++)
+    while ((sl = mm->slabs[cls]) != NULL)
+      {
+        mm->slabs[cls] = sl->sl_next;
+        free (sl->sl_used);
+        free (sl);
+      }
+
+  return 0;
+}
+
+// #endif
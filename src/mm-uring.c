@@ -0,0 +1,655 @@
+// #ifdef MM_SWAP_URING
+/*
+ * PAGING based Memory Management
+ * Asynchronous swap file I/O mm/mm-uring.c
+ */
+
+#define _GNU_SOURCE /* O_DIRECT */
+#include "mm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+/*
+ * A swap file read and written with page sized requests on an io_uring,
+ * reached through the raw system calls. The block layer hands over each
+ * dispatched request, writes are in flight once submitted and complete in
+ * the background, reaped at every unplug, kswapd doing one per time slot.
+ * Reads are waited for before the unplug returns, the faulting process
+ * alone stalls on them. A read reaped meanwhile by another thread is kept
+ * aside, the page only lands in memory in a thread waiting for the reads,
+ * never behind the back of the one holding the destination. A request on a
+ * frame already in flight waits for it to be reaped, a failed transfer
+ * being redone by then, so the file sees them in order.
+ * Without io_uring in the host kernel every request is carried out on the
+ * spot with pread/pwrite. The file is opened O_DIRECT when the page size
+ * allows, through page aligned bounce buffers.
+ *
+ * The ring has its own lock, the block layer submits under the device lock
+ * but waits after dropping it. A single thread at a time sleeps in the
+ * kernel for completions, with the ring unlocked, the others wait for it
+ * to reap. The waits left under the device lock are those of a submission,
+ * finding every slot of the ring in flight or its frame busy, until one
+ * completes.
+ */
+
+struct uring_io
+{
+  int fpn;
+  int wr;
+  BYTE *buf; /* aligned bounce page */
+
+  struct memphy_struct *mem; /* read destination frame */
+  int memfpn;
+
+  struct uring_io *next;
+};
+
+struct swap_uring
+{
+  int fd;     /* swap file */
+  int direct; /* opened O_DIRECT */
+  int ringfd; /* -1 without io_uring, pread/pwrite then */
+
+  /* Rings shared with the kernel */
+  unsigned entries;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_sz, cq_sz;
+  struct io_uring_sqe *sqes;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  unsigned nr_queued; /* SQEs not handed to the kernel yet */
+  struct uring_io *inflight;
+  int nr_inflight;
+  int nr_rdinflight;
+  struct uring_io *landed; /* reads reaped, not copied to memory yet */
+
+  /* Guards all of the above, taken after the device lock */
+  pthread_mutex_t lock;
+  int reaping;            /* a thread waits in the kernel */
+  pthread_cond_t reaped; /* it is done */
+
+  /* Statistics */
+  unsigned long nr_io, nr_enter, nr_busy, nr_sync;
+};
+
+static int
+uring_setup (unsigned entries, struct io_uring_params *p)
+{
+  return (int)syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter (int ringfd, unsigned to_submit, unsigned min_complete,
+             unsigned flags)
+{
+  return (int)syscall (__NR_io_uring_enter, ringfd, to_submit, min_complete,
+                       flags, NULL, 0);
+}
+
+/*
+ *  uring_map - set up the rings of a new io_uring
+ *  @ring: swap ring, ringfd set
+ *  @p: parameters returned by the setup
+ */
+static int
+uring_map (struct swap_uring *ring, struct io_uring_params *p)
+{
+  ring->sq_sz = p->sq_off.array + p->sq_entries * sizeof (unsigned);
+  ring->cq_sz = p->cq_off.cqes + p->cq_entries * sizeof (struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_sz = ring->cq_sz = (ring->sq_sz > ring->cq_sz) ? ring->sq_sz
+                                                            : ring->cq_sz;
+
+  ring->sq_ptr = mmap (NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->ringfd,
+                       IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED)
+    return -1;
+
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ptr = ring->sq_ptr;
+  else
+    {
+      ring->cq_ptr = mmap (NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->ringfd,
+                           IORING_OFF_CQ_RING);
+      if (ring->cq_ptr == MAP_FAILED)
+        {
+          munmap (ring->sq_ptr, ring->sq_sz);
+          return -1;
+        }
+    }
+
+  ring->sqes = mmap (NULL, p->sq_entries * sizeof (struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring->ringfd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      if (ring->cq_ptr != ring->sq_ptr)
+        munmap (ring->cq_ptr, ring->cq_sz);
+      munmap (ring->sq_ptr, ring->sq_sz);
+      return -1;
+    }
+
+  ring->entries = p->sq_entries;
+  ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p->sq_off.tail);
+  ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p->sq_off.ring_mask);
+  ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p->sq_off.array);
+  ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p->cq_off.head);
+  ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p->cq_off.tail);
+  ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p->cq_off.ring_mask);
+  ring->cqes
+      = (struct io_uring_cqe *)((char *)ring->cq_ptr + p->cq_off.cqes);
+
+  return 0;
+}
+
+/*
+ *  uring_pio - carry out a transfer with pread/pwrite
+ *  @ring: swap ring
+ *  @fpn: frame of the file
+ *  @buf: aligned page
+ *  @wr: write buf instead of reading it
+ *
+ *  A file refusing direct I/O is switched back to buffered I/O.
+ */
+static int
+uring_pio (struct swap_uring *ring, int fpn, BYTE *buf, int wr)
+{
+  off_t off = (off_t)fpn * PAGING_PAGESZ;
+  ssize_t ret;
+
+  for (;;)
+    {
+      ret = wr ? pwrite (ring->fd, buf, PAGING_PAGESZ, off)
+               : pread (ring->fd, buf, PAGING_PAGESZ, off);
+      if (ret == PAGING_PAGESZ)
+        return 0;
+
+      if (ret >= 0 && !wr)
+        { /* Past the end of a file shrunk behind our back, reads zero */
+          memset (buf + ret, 0, PAGING_PAGESZ - ret);
+          return 0;
+        }
+
+      if (ret < 0 && errno == EINTR)
+        continue;
+
+      if (ret < 0 && errno == EINVAL && ring->direct)
+        {
+          fcntl (ring->fd, F_SETFL, fcntl (ring->fd, F_GETFL) & ~O_DIRECT);
+          ring->direct = 0;
+          continue;
+        }
+
+      return -1;
+    }
+}
+
+/*
+ *  uring_inflight - account a transfer about to be carried out
+ *  @ring: swap ring, locked
+ *  @io: transfer
+ */
+static void
+uring_inflight (struct swap_uring *ring, struct uring_io *io)
+{
+  io->next = ring->inflight;
+  ring->inflight = io;
+  ring->nr_inflight++;
+  if (!io->wr)
+    ring->nr_rdinflight++;
+}
+
+/*
+ *  uring_done - finish a transfer, a page read is set aside for uring_land
+ *  @ring: swap ring
+ *  @io: transfer
+ *  @res: result of the transfer, redone synchronously unless a full page
+ *
+ *  No later transfer of the frame is submitted before this one is done.
+ */
+static void
+uring_done (struct swap_uring *ring, struct uring_io *io, int res)
+{
+  struct uring_io **iop;
+
+  if (res != PAGING_PAGESZ)
+    {
+      ring->nr_sync++;
+      uring_pio (ring, io->fpn, io->buf, io->wr);
+    }
+
+  for (iop = &ring->inflight; *iop != io; iop = &(*iop)->next)
+    ;
+  *iop = io->next;
+  ring->nr_inflight--;
+
+  if (io->wr)
+    {
+      free (io->buf);
+      free (io);
+      return;
+    }
+
+  ring->nr_rdinflight--;
+  io->next = ring->landed;
+  ring->landed = io;
+}
+
+/*
+ *  uring_land - copy the pages read to their destination
+ *  @ring: swap ring, locked
+ *
+ *  Only done by a thread waiting for the reads: until they land it is
+ *  still held by their submitter, whose destination frames stay put.
+ */
+static void
+uring_land (struct swap_uring *ring)
+{
+  struct uring_io *io;
+
+  while (ring->landed != NULL)
+    {
+      io = ring->landed;
+      ring->landed = io->next;
+      MEMPHY_write_frame (io->mem, io->memfpn, io->buf);
+      free (io->buf);
+      free (io);
+    }
+}
+
+/*
+ *  uring_reap - finish every completed transfer
+ *  @ring: swap ring
+ */
+static int
+uring_reap (struct swap_uring *ring)
+{
+  unsigned head = *ring->cq_head, tail;
+  struct io_uring_cqe *cqe;
+  int nr = 0;
+
+  tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail)
+    {
+      cqe = &ring->cqes[head & *ring->cq_mask];
+      uring_done (ring, (struct uring_io *)(unsigned long)cqe->user_data,
+                  cqe->res);
+      head++;
+      nr++;
+    }
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return nr;
+}
+
+/*
+ *  uring_flush - hand the queued SQEs to the kernel
+ *  @ring: swap ring, locked
+ */
+static void
+uring_flush (struct swap_uring *ring)
+{
+  int ret;
+
+  if (ring->nr_queued == 0)
+    return;
+
+  do
+    ret = uring_enter (ring->ringfd, ring->nr_queued, 0, 0);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret > 0)
+    ring->nr_queued -= ((unsigned)ret < ring->nr_queued) ? ret
+                                                         : ring->nr_queued;
+  ring->nr_enter++;
+}
+
+/*
+ *  uring_sleep - wait for at least one transfer in flight to complete
+ *  @ring: swap ring, locked once, a transfer in flight
+ *
+ *  The ring is unlocked while sleeping in the kernel.
+ */
+static void
+uring_sleep (struct swap_uring *ring)
+{
+  int ret;
+
+  if (ring->reaping)
+    { /* Another thread sleeps for the completions, let it reap */
+      pthread_cond_wait (&ring->reaped, &ring->lock);
+      return;
+    }
+
+  /* What others queued meanwhile may be what is waited for */
+  uring_flush (ring);
+
+  ring->reaping = 1;
+  pthread_mutex_unlock (&ring->lock);
+  do
+    ret = uring_enter (ring->ringfd, 0, 1, IORING_ENTER_GETEVENTS);
+  while (ret < 0 && errno == EINTR);
+  pthread_mutex_lock (&ring->lock);
+
+  ring->nr_enter++;
+  uring_reap (ring);
+  ring->reaping = 0;
+  pthread_cond_broadcast (&ring->reaped);
+}
+
+/*
+ *  uring_busy - tell whether a transfer of a frame is in flight
+ *  @ring: swap ring, locked
+ *  @fpn: frame of the file
+ */
+static int
+uring_busy (struct swap_uring *ring, int fpn)
+{
+  struct uring_io *it;
+
+  for (it = ring->inflight; it != NULL; it = it->next)
+    if (it->fpn == fpn)
+      return 1;
+
+  return 0;
+}
+
+/*
+ *  uring_wait_locked - wait for the transfers in flight, the pages read
+ *  land in memory
+ *  @ring: swap ring, locked once
+ *  @rdonly: only for the reads, the writes may go on
+ */
+static void
+uring_wait_locked (struct swap_uring *ring, int rdonly)
+{
+  if (ring->ringfd >= 0)
+    {
+      uring_flush (ring);
+      if (!ring->reaping)
+        uring_reap (ring);
+
+      while ((rdonly ? ring->nr_rdinflight : ring->nr_inflight) > 0)
+        uring_sleep (ring);
+    }
+
+  uring_land (ring);
+}
+
+/*
+ *  uring_poll - submit the queued transfers, finish the completed ones
+ *  @ring: swap ring
+ *
+ *  The pages read are left for the thread waiting for them. Return the
+ *  number of transfers finished.
+ */
+int
+uring_poll (struct swap_uring *ring)
+{
+  int nr = 0;
+
+  if (ring->ringfd < 0)
+    return 0;
+
+  pthread_mutex_lock (&ring->lock);
+  uring_flush (ring);
+  if (!ring->reaping) /* The completions are its own */
+    nr = uring_reap (ring);
+  pthread_mutex_unlock (&ring->lock);
+
+  return nr;
+}
+
+/*
+ *  uring_wait - wait for every transfer in flight
+ *  @ring: swap ring
+ */
+int
+uring_wait (struct swap_uring *ring)
+{
+  pthread_mutex_lock (&ring->lock);
+  uring_wait_locked (ring, 0);
+  pthread_mutex_unlock (&ring->lock);
+
+  return 0;
+}
+
+/*
+ *  uring_wait_reads - wait for the reads in flight, finish what completed
+ *  @ring: swap ring
+ */
+int
+uring_wait_reads (struct swap_uring *ring)
+{
+  pthread_mutex_lock (&ring->lock);
+  uring_wait_locked (ring, 1);
+  pthread_mutex_unlock (&ring->lock);
+
+  return 0;
+}
+
+/*
+ *  uring_submit - queue a page transfer
+ *  @ring: swap ring
+ *  @fpn: frame of the file
+ *  @buf: page written, copied, or NULL to read the frame
+ *  @mem: read destination device, random access
+ *  @memfpn: read destination frame
+ *
+ *  The transfer is only handed to the kernel by the next poll or wait.
+ */
+int
+uring_submit (struct swap_uring *ring, int fpn, const BYTE *buf,
+              struct memphy_struct *mem, int memfpn)
+{
+  struct io_uring_sqe *sqe;
+  struct uring_io *io;
+  unsigned tail;
+
+  io = malloc (sizeof (struct uring_io));
+  if (io == NULL)
+    return -1;
+
+  if (posix_memalign ((void **)&io->buf, PAGING_URING_ALIGN,
+                      PAGING_MAX_PAGESZ)
+      != 0)
+    {
+      free (io);
+      return -1;
+    }
+
+  io->fpn = fpn;
+  io->wr = (buf != NULL);
+  io->mem = mem;
+  io->memfpn = memfpn;
+  if (io->wr)
+    memcpy (io->buf, buf, PAGING_PAGESZ);
+
+  pthread_mutex_lock (&ring->lock);
+  ring->nr_io++;
+
+  if (ring->ringfd < 0)
+    { /* No io_uring, done on the spot, the page read lands with the
+       * waiting unplug like any other */
+      uring_inflight (ring, io);
+      uring_done (ring, io, (uring_pio (ring, fpn, io->buf, io->wr) == 0)
+                                ? PAGING_PAGESZ
+                                : -1);
+      pthread_mutex_unlock (&ring->lock);
+      return 0;
+    }
+
+  /* The completion ring holds twice the submission ring */
+  if (!ring->reaping)
+    uring_reap (ring);
+  while (ring->nr_inflight >= (int)ring->entries)
+    uring_sleep (ring);
+
+  /* Keep the transfers on one frame in order: the former one is done,
+   * redone if it failed, before this one reaches the kernel */
+  if (uring_busy (ring, fpn))
+    {
+      ring->nr_busy++;
+      do
+        uring_sleep (ring);
+      while (uring_busy (ring, fpn));
+    }
+  uring_inflight (ring, io);
+
+  tail = *ring->sq_tail;
+  sqe = &ring->sqes[tail & *ring->sq_mask];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = io->wr ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = ring->fd;
+  sqe->addr = (unsigned long)io->buf;
+  sqe->len = PAGING_PAGESZ;
+  sqe->off = (unsigned long long)fpn * PAGING_PAGESZ;
+  sqe->user_data = (unsigned long)io;
+  ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->nr_queued++;
+  pthread_mutex_unlock (&ring->lock);
+
+  return 0;
+}
+
+/*
+ *  uring_rw - transfer a page right away
+ *  @ring: swap ring
+ *  @fpn: frame of the file
+ *  @buf: page buffer
+ *  @wr: write buf to the frame instead of reading it
+ */
+int
+uring_rw (struct swap_uring *ring, int fpn, BYTE *buf, int wr)
+{
+  BYTE *page;
+  int ret;
+
+  if (posix_memalign ((void **)&page, PAGING_URING_ALIGN, PAGING_MAX_PAGESZ)
+      != 0)
+    return -1;
+
+  pthread_mutex_lock (&ring->lock);
+
+  /* Whatever is in flight lands first */
+  uring_wait_locked (ring, 0);
+
+  if (wr)
+    memcpy (page, buf, PAGING_PAGESZ);
+  ret = uring_pio (ring, fpn, page, wr);
+  if (!wr && ret == 0)
+    memcpy (buf, page, PAGING_PAGESZ);
+  ring->nr_sync++;
+
+  pthread_mutex_unlock (&ring->lock);
+  free (page);
+
+  return ret;
+}
+
+/*
+ *  uring_open - open a swap file on an io_uring
+ *  @path: swap file, created if missing
+ *  @size: file size
+ */
+struct swap_uring *
+uring_open (const char *path, addr_t size)
+{
+  struct swap_uring *ring;
+  struct io_uring_params p;
+
+  ring = calloc (1, sizeof (struct swap_uring));
+  if (ring == NULL)
+    return NULL;
+
+  /* Direct I/O needs every page on a block boundary */
+  ring->fd = -1;
+  if (PAGING_PAGESZ % PAGING_URING_ALIGN == 0)
+    {
+      ring->fd = open (path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+      ring->direct = (ring->fd >= 0);
+    }
+  if (ring->fd < 0)
+    ring->fd = open (path, O_RDWR | O_CREAT, 0644);
+
+  if (ring->fd < 0 || ftruncate (ring->fd, size) != 0)
+    {
+      if (ring->fd >= 0)
+        close (ring->fd);
+      free (ring);
+      return NULL;
+    }
+
+  memset (&p, 0, sizeof (p));
+  ring->ringfd = uring_setup (PAGING_URING_DEPTH, &p);
+  if (ring->ringfd >= 0 && uring_map (ring, &p) != 0)
+    {
+      close (ring->ringfd);
+      ring->ringfd = -1;
+    }
+
+  pthread_mutex_init (&ring->lock, NULL);
+  pthread_cond_init (&ring->reaped, NULL);
+
+  return ring;
+}
+
+/*
+ *  uring_close - finish the transfers and close the swap file
+ *  @ring: swap ring
+ */
+int
+uring_close (struct swap_uring *ring)
+{
+  uring_wait (ring);
+
+  if (ring->ringfd >= 0)
+    {
+      munmap (ring->sqes, ring->entries * sizeof (struct io_uring_sqe));
+      if (ring->cq_ptr != ring->sq_ptr)
+        munmap (ring->cq_ptr, ring->cq_sz);
+      munmap (ring->sq_ptr, ring->sq_sz);
+      close (ring->ringfd);
+    }
+
+  close (ring->fd);
+  pthread_cond_destroy (&ring->reaped);
+  pthread_mutex_destroy (&ring->lock);
+  free (ring);
+
+  return 0;
+}
+
+int
+uring_dump (struct swap_uring *ring, const char *name)
+{
+  printf ("%s: %s%s, %lu pages transferred in %lu system calls, "
+          "%lu on a busy frame, %lu synchronous\n",
+          name, (ring->ringfd >= 0) ? "io_uring" : "pread/pwrite",
+          ring->direct ? " O_DIRECT" : "", ring->nr_io, ring->nr_enter,
+          ring->nr_busy, ring->nr_sync);
+
+  return 0;
+}
+
+// #endif
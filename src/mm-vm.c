@@ -13,28 +13,14 @@
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
  *@rg_elmt: new region
+ *@retrg: return the free region it is coalesced into
  */
 int
-enlist_vm_freerg_list (struct mm_struct *mm, struct vm_rg_struct rg_elmt)
+enlist_vm_freerg_list (struct mm_struct *mm, struct vm_rg_struct rg_elmt,
+                       struct vm_rg_struct *retrg)
 {
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-  struct vm_rg_struct *new_rgnode = malloc (sizeof (struct vm_rg_struct));
-
-  if (rg_elmt.rg_start >= rg_elmt.rg_end)
-    return -1;
-
-  if (rg_node != NULL)
-    {
-      new_rgnode->rg_next = rg_node;
-    }
-
-  new_rgnode->rg_start = rg_elmt.rg_start;
-  new_rgnode->rg_end = rg_elmt.rg_end;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = new_rgnode;
-
-  return 0;
+  return freerg_insert (&mm->mmap->vm_freerg, rg_elmt.rg_start,
+                        rg_elmt.rg_end, retrg);
 }
 
 /*get_vma_by_num - get vm area by numID
@@ -57,6 +43,7 @@ get_vma_by_num (struct mm_struct *mm, int vmaid)
         return NULL;
 
       pvma = pvma->vm_next;
+      vmait++;
     }
 
   return pvma;
@@ -76,6 +63,56 @@ get_symrg_byid (struct mm_struct *mm, int rgid)
   return &mm->symrgtbl[rgid];
 }
 
+/*vm_alloc_rg - get a virtual region, from the free ones or the area end
+ *@caller: caller
+ *@vmaid: ID vm area to alloc memory region
+ *@size: allocated size
+ *@newrg: return the region
+ */
+int
+vm_alloc_rg (struct pcb_t *caller, int vmaid, int size,
+             struct vm_rg_struct *newrg)
+{
+  struct vm_area_struct *cur_vma = get_vma_by_num (caller->mm, vmaid);
+
+  /* If found free vmrg_area
+   * return the area to alloc_addr
+   * */
+  if (get_free_vmrg_area (caller, vmaid, size, newrg) == 0)
+    {
+#ifdef MMDBG
+      printf ("\t[ALLOC] PID=%d get free region %lu %lu\n", caller->pid,
+              newrg->rg_start, newrg->rg_end);
+#endif
+
+#ifndef MM_DEMAND
+      /* Pages of a reused region may have been released on __free */
+      if (vm_populate_rg (caller, newrg->rg_start, newrg->rg_end) < 0)
+        return -1;
+#endif
+
+      return 0;
+    }
+
+  /* INCREASE THE LIMIT
+   * Ascender the sbrk cursor
+   * inc_vma_limit(caller, vmaid, inc_sz)
+   */
+  if (inc_vma_limit (caller, vmaid, size, newrg) != 0)
+    return -1;
+
+  /* The area grows by whole pages, what the region leaves of the last one
+   * is free for the next small regions */
+  if (newrg->rg_end > newrg->rg_start + size)
+    {
+      freerg_insert (&cur_vma->vm_freerg, newrg->rg_start + size,
+                     newrg->rg_end, NULL);
+      newrg->rg_end = newrg->rg_start + size;
+    }
+
+  return 0;
+}
+
 /*__alloc - allocate a region memory
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -85,45 +122,400 @@ get_symrg_byid (struct mm_struct *mm, int rgid)
  */
 int
 __alloc (struct pcb_t *caller, int vmaid, int rgid, int size,
-         uint32_t *alloc_addr)
+         addr_t *alloc_addr)
 {
   /*Allocate at the toproof */
   struct vm_rg_struct rgnode;
+  int stat;
 
-  /* If found free vmrg_area
-   * return the area to alloc_addr
-   * */
-  if (get_free_vmrg_area (caller, vmaid, size, &rgnode) == 0)
+  pthread_mutex_lock (&caller->mm->mm_lock);
+
+#ifdef MM_SLAB
+  /* Small regions are packed several to a page */
+  if (size > 0 && size <= PAGING_SLAB_MAXSZ)
+    stat = slab_alloc (caller, vmaid, size, &rgnode);
+  else
+#endif
+    stat = vm_alloc_rg (caller, vmaid, size, &rgnode);
+
+  if (stat == 0)
     {
       caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
       caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+      *alloc_addr = rgnode.rg_start;
+    }
+
+  pthread_mutex_unlock (&caller->mm->mm_lock);
+
+  return (stat == 0) ? 0 : -1;
+}
+
+/*pg_readahead - bring in the swapped pages following a faulted page
+ *@mm: memory region
+ *@pgn: PGN of the faulted page
+ *@swptyp: swap device the faulted page was read from
+ *@swpoff: swap slot the faulted page was read from
+ *@caller: caller
+ *
+ * Only pages of the same VMA laid out right after the faulted page in swap
+ * are read, and only into frames already free: readahead never evicts.
+ */
+static void
+pg_readahead (struct mm_struct *mm, int pgn, int swptyp, int swpoff,
+              struct pcb_t *caller)
+{
+  struct memphy_struct *dev = swap_dev (caller->active_mswp, swptyp);
+  struct vm_area_struct *vma = mm->mmap;
+  struct framephy_struct *fp;
+  pte_t pte;
+  int it, fpn, endpgn;
+
+  while (vma != NULL && PAGING_PGN (vma->vm_end - 1) < pgn)
+    vma = vma->vm_next;
+
+  if (vma == NULL)
+    return;
+
+  endpgn = PAGING_PGN (vma->vm_end - 1);
+
+  for (it = 1; it < mm->ra_win && pgn + it <= endpgn; it++)
+    {
+      pte = pte_get (mm, pgn + it);
+
+      if (PAGING_PAGE_PRESENT (pte) || !PAGING_PAGE_SWAPPED (pte)
+          || PAGING_PTE_SWPTYP (pte) != swptyp
+          || PAGING_PTE_SWPOFF (pte) != swpoff + it
+          || dev->frmtbl[swpoff + it].mapcount > 1)
+        break;
+
+#ifdef MM_MEMCG
+      if (memcg_over (mm->memcg, 1))
+        break; /* Not worth an eviction in the group either */
+#endif
+
+      if (MEMPHY_get_freefp_near (caller->mram, numa_node (caller), &fpn)
+          != 0)
+        break;
+
+#ifdef MM_BLK
+      /* Queued, the window reaches the device as a single request */
+      dev->nr_rdpg++;
+      blk_submit_read (dev, swpoff + it, caller->mram, fpn);
+#else
+      __swap_cp_page (dev, swpoff + it, caller->mram, fpn);
+#endif
+
+      pte_set_fpn (pte_ptr (mm, pgn + it), fpn);
+      CLRBIT (*pte_ptr (mm, pgn + it), PAGING_PTE_DIRTY_MASK);
+      MEMPHY_set_rmap (caller->mram, fpn, mm, pgn + it);
+      mm_charge (mm, 1);
+
+      /* Not referenced yet, the first to go if it turns out useless */
+      fp = &caller->mram->frmtbl[fpn];
+      __atomic_store_n (&fp->refbit, 0, __ATOMIC_RELAXED);
+      __atomic_store_n (&fp->rabit, 1, __ATOMIC_RELAXED);
+      fp->swptyp = swptyp;
+      fp->swpoff = swpoff + it;
+    }
+
+#ifdef MM_BLK
+  blk_unplug (dev);
+#endif
+}
+
+/*pg_swapin - bring a swapped out page back to MEMRAM
+ *@mm: memory region
+ *@pgn: PGN
+ *@caller: caller
+ *
+ */
+static int
+pg_swapin (struct mm_struct *mm, int pgn, struct pcb_t *caller)
+{
+  struct memphy_struct *dev;
+  pte_t pte;
+  int tgtfpn, heat = 0;
+  int swptyp, swpoff;
+
+  /* Get a frame in MEMRAM, a victim of any process may be evicted */
+  if (get_free_frame (caller, &tgtfpn) != 0)
+    return -1;
+
+  /* The eviction may have moved our page out of the compressed pool */
+  pte = pte_get (mm, pgn);
+  swptyp = PAGING_PTE_SWPTYP (pte); // The swap device storing our page
+  swpoff = PAGING_PTE_SWPOFF (pte); // The swap frame storing our page
+  dev = swap_dev (caller->active_mswp, swptyp);
+
+#ifdef MM_ZSWAP
+  if (PAGING_PTE_SWPTYP (pte) == PAGING_ZSWAP_SWPTYP)
+    { /* Decompress from the pool, no copy is left behind */
+      zswap_load (swpoff, caller->mram, tgtfpn);
+      heat = __atomic_load_n (&caller->mram->frmtbl[tgtfpn].heat,
+                              __ATOMIC_RELAXED);
+      pte_set_fpn (pte_ptr (mm, pgn), tgtfpn);
+      MEMPHY_set_rmap (caller->mram, tgtfpn, mm, pgn);
+    }
+  else
+#endif
+  if (dev->frmtbl[swpoff].mapcount > 1)
+    { /* Other PTEs still use the slot, the page comes in private and
+       * without swap cache */
+      __swap_cp_page (dev, swpoff, caller->mram, tgtfpn);
+      heat = dev->frmtbl[swpoff].heat;
+      put_swap_entry (caller->active_mswp, pte);
+      pte_set_fpn (pte_ptr (mm, pgn), tgtfpn);
+      SETBIT (*pte_ptr (mm, pgn), PAGING_PTE_DIRTY_MASK);
+      MEMPHY_set_rmap (caller->mram, tgtfpn, mm, pgn);
+    }
+  else
+    {
+      /* Copy target frame from swap to mem */
+      __swap_cp_page (dev, swpoff, caller->mram, tgtfpn);
+      heat = dev->frmtbl[swpoff].heat;
+
+      /* Update the target page online status, it is clean as long as
+       * it matches the copy kept in the swap cache */
+      pte_set_fpn (pte_ptr (mm, pgn), tgtfpn);
+      CLRBIT (*pte_ptr (mm, pgn), PAGING_PTE_DIRTY_MASK);
+      MEMPHY_set_rmap (caller->mram, tgtfpn, mm, pgn);
+      caller->mram->frmtbl[tgtfpn].swptyp = swptyp;
+      caller->mram->frmtbl[tgtfpn].swpoff = swpoff;
+
+      pg_readahead (mm, pgn, swptyp, swpoff, caller);
+    }
+
+  /* A page swapped out hot comes back hot */
+  __atomic_store_n (&caller->mram->frmtbl[tgtfpn].heat, heat,
+                    __ATOMIC_RELAXED);
+  mm_charge (mm, 1);
+#ifdef MM_MEMCG
+  if (mm->memcg != NULL)
+    __atomic_fetch_add (&mm->memcg->nr_swapin, 1, __ATOMIC_RELAXED);
+#endif
+
+  return 0;
+}
+
+/*pg_hugehead - find the huge mapping covering a page
+ *@mm: memory region
+ *@pgn: PGN
+ *
+ * Return the PGN of the PTE mapping the huge page, -1 if there is none.
+ */
+static int
+pg_hugehead (struct mm_struct *mm, int pgn)
+{
+  int head = pgn & ~(PAGING_HUGE_NR - 1);
+
+  if (PAGING_HUGE_NR > 1 && (pte_get (mm, head) & PAGING_PTE_HUGE_MASK))
+    return head;
+
+  return -1;
+}
+
+#ifdef MM_DEMAND
+/*pg_mapzero_huge - map the huge page around a page touched first
+ *@mm: memory region
+ *@pgn: PGN
+ *@vma: area holding the page
+ *@caller: caller
+ *
+ * Only done when the whole aligned range lies in the area with none of
+ * its pages mapped yet, and contiguous free frames are available to a
+ * group without limit: nothing is evicted for a huge page.
+ */
+static int
+pg_mapzero_huge (struct mm_struct *mm, int pgn, struct vm_area_struct *vma,
+                 struct pcb_t *caller)
+{
+  int head = pgn & ~(PAGING_HUGE_NR - 1);
+  int fpn, it;
+
+  if (PAGING_HUGE_NR <= 1
+      || (unsigned long)head * PAGING_PAGESZ < vma->vm_start
+      || (unsigned long)(head + PAGING_HUGE_NR) * PAGING_PAGESZ > vma->vm_end)
+    return -1;
+
+  for (it = 0; it < PAGING_HUGE_NR; it++)
+    if (pte_get (mm, head + it) != 0)
+      return -1;
+
+#ifdef MM_MEMCG
+  /* Huge pages are never reclaimed nor charged, a limited group cannot
+   * have them */
+  if (mm->memcg != NULL && mm->memcg->limit > 0)
+    return -1;
+#endif
+
+  if (MEMPHY_get_freefp_range (caller->mram, PAGING_HUGE_NR, &fpn) != 0)
+    return -1;
+
+  for (it = 0; it < PAGING_HUGE_NR; it++)
+    MEMPHY_clear_frame (caller->mram, fpn + it);
+
+  /* The frames stay without owner, replacement leaves them alone */
+  init_pte (pte_ptr (mm, head), /* present: */ 1, /* fpn: */ fpn,
+            /* drt: */ 0, /* swp: */ 0, /* swptyp */ 0, /*  swpoff */ 0);
+  SETBIT (*pte_ptr (mm, head), PAGING_PTE_HUGE_MASK);
+  mm_charge (mm, PAGING_HUGE_NR);
+
 #ifdef MMDBG
-      printf ("\t[ALLOC] PID=%d get free region %lu %lu\n", caller->pid,
-              rgnode.rg_start, rgnode.rg_end);
+  printf ("\t[HUGE] PID=%d pages %d-%d on frames %d-%d\n", caller->pid, head,
+          head + PAGING_HUGE_NR - 1, fpn, fpn + PAGING_HUGE_NR - 1);
 #endif
 
-      *alloc_addr = rgnode.rg_start;
+  return 0;
+}
 
+/*pg_mapzero - map a page reserved by ALLOC on its first touch
+ *@mm: memory region
+ *@pgn: PGN
+ *@caller: caller
+ *
+ */
+static int
+pg_mapzero (struct mm_struct *mm, int pgn, struct pcb_t *caller)
+{
+  struct vm_area_struct *vma;
+  unsigned long addr = (unsigned long)pgn * PAGING_PAGESZ;
+  int fpn;
+
+  /* Outside of every area the access is invalid */
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+    if (addr >= vma->vm_start && addr < vma->vm_end)
+      break;
+
+  if (vma == NULL)
+    return -1;
+
+  if (pg_mapzero_huge (mm, pgn, vma, caller) == 0)
+    return 0;
+
+#ifdef MM_KSM
+  if (caller->mram->zero_fpn >= 0)
+    { /* Reads share the zero frame, the first write takes a private copy */
+      init_pte (pte_ptr (mm, pgn), /* present: */ 1,
+                /* fpn: */ caller->mram->zero_fpn, /* drt: */ 0,
+                /* swp: */ 0, /* swptyp */ 0, /*  swpoff */ 0);
+      SETBIT (*pte_ptr (mm, pgn), PAGING_PTE_COW_MASK);
+      mm_charge (mm, 1);
       return 0;
     }
+#endif
 
-  /*Attempt to increate limit to get space */
-  // int inc_sz = PAGING_PAGE_ALIGNSZ (size);
-  // int inc_limit_ret
+  if (get_free_frame (caller, &fpn) != 0)
+    return -1;
 
-  /* INCREASE THE LIMIT
-   * Ascender the sbrk cursor
-   * inc_vma_limit(caller, vmaid, inc_sz)
-   */
-  int stat = inc_vma_limit (caller, vmaid, size, &caller->mm->symrgtbl[rgid]);
+  MEMPHY_clear_frame (caller->mram, fpn);
+
+  init_pte (pte_ptr (mm, pgn), /* present: */ 1, /* fpn: */ fpn, /* drt: */ 0,
+            /* swp: */ 0, /* swptyp */ 0, /*  swpoff */ 0);
+  MEMPHY_set_rmap (caller->mram, fpn, mm, pgn);
+  mm_charge (mm, 1);
+
+  return 0;
+}
+#endif
+
+/*pg_touch - account an access to a resident page
+ *@fpn: frame of the page
+ *@caller: caller
+ *
+ * The reference gives the page a second chance against the clock hand,
+ * the count tells hot pages from warm ones.
+ */
+static void
+pg_touch (int fpn, struct pcb_t *caller)
+{
+  struct memphy_struct *mram = caller->mram;
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+
+  __atomic_store_n (&fp->refbit, 1, __ATOMIC_RELAXED);
+  if (__atomic_load_n (&fp->heat, __ATOMIC_RELAXED) < PAGING_HEAT_MAX)
+    __atomic_fetch_add (&fp->heat, 1, __ATOMIC_RELAXED);
+
+#ifdef MM_NUMA
+  if (MEMPHY_node (mram, fpn) == caller->node)
+    {
+      __atomic_store_n (&fp->remote, 0, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&mram->nr_local, 1, __ATOMIC_RELAXED);
+    }
+  else
+    {
+      __atomic_fetch_add (&fp->remote, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&mram->nr_remote, 1, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+#ifdef MM_NUMA
+/*pg_misplaced - a private page the caller keeps using from another node
+ *@fpn: frame of the page
+ *@caller: caller
+ */
+static int
+pg_misplaced (int fpn, struct pcb_t *caller)
+{
+  struct framephy_struct *fp = &caller->mram->frmtbl[fpn];
+
+  return caller->mram->nr_nodes > 1
+         && MEMPHY_node (caller->mram, fpn) != caller->node
+         && __atomic_load_n (&fp->remote, __ATOMIC_RELAXED)
+                >= PAGING_NUMA_MIGRATE_HITS
+         && fp->mapcount == 1
+         && fp->owner == caller->mm && fpn != caller->mram->zero_fpn;
+}
+
+/*pg_migrate - move a page to the node of the CPU running the caller
+ *@mm: memory region, locked
+ *@pgn: PGN
+ *@fpn: frame of the page, return the new one
+ *@caller: caller
+ *
+ * Nothing happens when the node has no free frame, the page is not worth
+ * an eviction.
+ */
+static int
+pg_migrate (struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
+{
+  struct memphy_struct *mram = caller->mram;
+  struct framephy_struct *fp = &mram->frmtbl[*fpn], *newfp;
+  BYTE page[PAGING_MAX_PAGESZ];
+  pte_t *pte = pte_ptr (mm, pgn);
+  int newfpn;
+
+  if (*pte & PAGING_PTE_COW_MASK)
+    return -1;
 
-  if (stat == -1)
+  if (MEMPHY_get_freefp_node (mram, caller->node, &newfpn) != 0)
     return -1;
 
-  *alloc_addr = caller->mm->symrgtbl[rgid].rg_start;
+  MEMPHY_read_frame (mram, *fpn, page);
+  MEMPHY_write_frame (mram, newfpn, page);
+
+  mm_seq_begin (mm);
+  SETVAL (*pte, newfpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  mm_seq_end (mm);
+
+  /* The page keeps its history and its swap cache slot */
+  MEMPHY_set_rmap (mram, newfpn, mm, pgn);
+  newfp = &mram->frmtbl[newfpn];
+  __atomic_store_n (&newfp->heat,
+                    __atomic_load_n (&fp->heat, __ATOMIC_RELAXED),
+                    __ATOMIC_RELAXED);
+  newfp->swptyp = fp->swptyp;
+  newfp->swpoff = fp->swpoff;
+  fp->swpoff = -1;
+
+  MEMPHY_set_rmap (mram, *fpn, NULL, -1);
+  MEMPHY_put_freefp (mram, *fpn);
+  *fpn = newfpn;
+  __atomic_fetch_add (&mram->nr_migrated, 1, __ATOMIC_RELAXED);
 
   return 0;
 }
+#endif
 
 /*pg_getpage - get the page in ram
  *@mm: memory region
@@ -135,50 +527,59 @@ __alloc (struct pcb_t *caller, int vmaid, int rgid, int size,
 int
 pg_getpage (struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 {
-  uint32_t pte = mm->pgd[pgn];
+  pte_t pte = pte_get (mm, pgn);
+  struct framephy_struct *fp;
+  int head;
 
-  if (!PAGING_PAGE_PRESENT (pte))
+  head = pg_hugehead (mm, pgn);
+  if (head < 0 && !PAGING_PAGE_PRESENT (pte))
     { /* Page is not online, make it actively living */
-      struct memphy_struct *swpsrc = NULL;
-      int vicpgn, swpfpn;
-      int vicfpn;
-      uint32_t vicpte;
-      int swptype
-          = 0; /* We only have one swap devices which is the first one */
-
-      int tgtfpn = PAGING_SWP (pte); // The target frame storing our variable
+      int ret = -1; /* Page was never mapped */
 
-      /* Find and pop victim page out */
-      if (find_victim_page (caller->mm, &vicpgn) != 0)
-        return -1;              /* Invalid page access */
-
-      vicpte = mm->pgd[vicpgn]; /* Get victim's page entry */
+#ifdef MM_MEMCG
+      if (mm->memcg != NULL)
+        __atomic_fetch_add (&mm->memcg->nr_fault, 1, __ATOMIC_RELAXED);
+#endif
 
-      vicfpn = GETVAL (vicpte, PAGING_PTE_FPN_MASK,
-                       PAGING_PTE_FPN_LOBIT); /* Get victim's frame number */
+      if (PAGING_PAGE_SWAPPED (pte))
+        {
+          __atomic_fetch_add (&caller->mram->nr_majflt, 1, __ATOMIC_RELAXED);
+          ret = pg_swapin (mm, pgn, caller);
+        }
+#ifdef MM_DEMAND
+      else
+        ret = pg_mapzero (mm, pgn, caller);
+#endif
 
-      /* Get free frame in MEMSWP */
-      if (MEMPHY_get_freefp (caller->active_mswp, &swpfpn) != 0)
+      if (ret != 0)
         return -1;
-      else
-        swpsrc = caller->active_mswp;
 
-      /* Do swap frame from MEMRAM to MEMSWP and vice versa*/
-      /* Copy victim frame to swap */
-      __swap_cp_page (caller->mram, vicfpn, swpsrc, swpfpn);
-      /* Copy target frame from swap to mem */
-      __swap_cp_page (caller->active_mswp, tgtfpn, caller->mram, vicfpn);
+      head = pg_hugehead (mm, pgn);
+    }
 
-      /* Update pte of victim to swap */
-      pte_set_swap (&mm->pgd[vicpgn], swptype, vicfpn);
+  /* Pages under a huge mapping are always resident */
+  if (head >= 0)
+    {
+      *fpn = PAGING_PTE_FPN (pte_get (mm, head)) + (pgn - head);
+      return 0;
+    }
 
-      /* Update the target page online status */
-      pte_set_fpn (&pte, tgtfpn);
+  *fpn = PAGING_PTE_FPN (pte_get (mm, pgn));
+  fp = &caller->mram->frmtbl[*fpn];
 
-      enlist_pgn_node (&caller->mm->fifo_pgn, pgn);
+  /* First touch of a page brought by readahead, widen the window */
+  if (__atomic_exchange_n (&fp->rabit, 0, __ATOMIC_RELAXED))
+    {
+      if (mm->ra_win < PAGING_RA_MAXWIN)
+        mm->ra_win *= 2;
     }
 
-  *fpn = GETVAL (mm->pgd[pgn], PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+#ifdef MM_NUMA
+  if (pg_misplaced (*fpn, caller))
+    pg_migrate (mm, pgn, fpn, caller);
+#endif
+
+  pg_touch (*fpn, caller);
 
   return 0;
 }
@@ -189,19 +590,30 @@ pg_getpage (struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
  *
  */
 void
-pg_putfree (struct mm_struct *mm, int addr, struct pcb_t *caller)
+pg_putfree (struct mm_struct *mm, addr_t addr, struct pcb_t *caller)
 {
   int pgn = PAGING_PGN (addr);
+  pte_t pte = pte_get (mm, pgn);
   int fpn;
 
-  /* Get the page to MEMRAM, swap from MEMSWAP if needed */
-  if (pg_getpage (mm, pgn, &fpn, caller) != 0)
-    return; /* invalid page access */
+  if (pte == 0)
+    return;
+
+  /* Release the frame wherever the page lives, no need to swap it in */
+  if (pte & PAGING_PTE_HUGE_MASK)
+    unmap_huge (caller->mram, mm, PAGING_PTE_FPN (pte));
+  else if (PAGING_PAGE_PRESENT (pte))
+    {
+      fpn = PAGING_PTE_FPN (pte);
 #ifdef MMDBG
-  printf("\tFree fpn: %d\n", fpn);
+      printf ("\tFree fpn: %d\n", fpn);
 #endif
+      unmap_frame (caller->mram, caller->active_mswp, fpn, mm, pgn);
+    }
+  else if (PAGING_PAGE_SWAPPED (pte))
+    put_swap_entry (caller->active_mswp, pte);
 
-  MEMPHY_put_freefp (caller->mram, fpn);
+  *pte_ptr (mm, pgn) = 0;
 }
 /*__free - remove a region memory
  *@caller: caller
@@ -214,30 +626,52 @@ int
 __free (struct pcb_t *caller, int vmaid, int rgid)
 {
   struct vm_rg_struct rgnode;
-  int size;
+  addr_t addr;
 
   if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
     return -1;
 
+  pthread_mutex_lock (&caller->mm->mm_lock);
+
   /* Manage the collect freed region to freerg_list */
   rgnode = caller->mm->symrgtbl[rgid];
-  size = rgnode.rg_end - rgnode.rg_start;
+  caller->mm->symrgtbl[rgid].rg_start = caller->mm->symrgtbl[rgid].rg_end = 0;
 
-  /*enlist the obsoleted memory region */
-  enlist_vm_freerg_list (caller->mm, rgnode);
+#ifdef MM_SLAB
+  /* A slab object only goes back to its slab, the slab chunk itself is
+   * freed below once it is empty */
+  if (slab_free (caller->mm, &rgnode) == 0)
+    {
+      pthread_mutex_unlock (&caller->mm->mm_lock);
+      return 0;
+    }
+#endif
+
+  /*enlist the obsoleted memory region, merged with its free neighbours */
+  if (enlist_vm_freerg_list (caller->mm, rgnode, &rgnode) != 0)
+    { /* Not allocated or already freed */
+      pthread_mutex_unlock (&caller->mm->mm_lock);
+      return -1;
+    }
 
 #ifdef MMDBG
-  print_list_rg (caller->mm->mmap->vm_freerg_list);
+  print_freerg (&caller->mm->mmap->vm_freerg);
 #endif
 
-  pthread_mutex_lock (caller->mlock);
-  /* enlist the obsolete memory frames*/
-  for (int it = 0; it < size; it+=PAGING_PAGESZ)
+  /* enlist the obsolete memory frames, only pages lying entirely in the
+   * free space since the others still back neighbouring regions */
+  for (addr = PAGING_PAGE_ALIGNSZ (rgnode.rg_start);
+       addr + PAGING_PAGESZ <= rgnode.rg_end; addr += PAGING_PAGESZ)
     {
-      pg_putfree (caller->mm, rgnode.rg_start + it, caller);
+      /* A huge page goes only once all of it is free */
+      if ((pte_get (caller->mm, PAGING_PGN (addr)) & PAGING_PTE_HUGE_MASK)
+          && addr + PAGING_HUGE_NR * PAGING_PAGESZ > rgnode.rg_end)
+        continue;
+
+      pg_putfree (caller->mm, addr, caller);
     }
 
-  pthread_mutex_unlock (caller->mlock);
+  pthread_mutex_unlock (&caller->mm->mm_lock);
 
   return 0;
 }
@@ -254,7 +688,7 @@ pgalloc (struct pcb_t *proc, uint32_t size, uint32_t reg_index)
 #ifdef MMDBG
   printf ("\talloc PID=%d size=%d region=%d\n", proc->pid, size, reg_index);
 #endif
-  uint32_t addr;
+  addr_t addr;
 
   /* By default using vmaid = 0 */
   return __alloc (proc, 0, reg_index, size, &addr);
@@ -275,6 +709,27 @@ pgfree_data (struct pcb_t *proc, uint32_t reg_index)
   return __free (proc, 0, reg_index);
 }
 
+/*pgfork - PAGING-based duplicate the address space of a process
+ *@proc: Process executing the instruction
+ *@child: new process, its mm is set up as a copy-on-write copy
+ */
+int
+pgfork (struct pcb_t *proc, struct pcb_t *child)
+{
+  int ret;
+
+#ifdef MMDBG
+  printf ("\tfork PID=%d child=%d\n", proc->pid, child->pid);
+#endif
+  child->mm = malloc (sizeof (struct mm_struct));
+
+  pthread_mutex_lock (&proc->mm->mm_lock);
+  ret = copy_mm (child->mm, proc->mm, proc);
+  pthread_mutex_unlock (&proc->mm->mm_lock);
+
+  return ret;
+}
+
 /*pg_getval - read value at given offset
  *@mm: memory region
  *@addr: virtual address to acess
@@ -282,7 +737,8 @@ pgfree_data (struct pcb_t *proc, uint32_t reg_index)
  *@caller: pcb
  */
 int
-pg_getval (struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
+pg_getval (struct mm_struct *mm, addr_t addr, BYTE *data,
+           struct pcb_t *caller)
 {
   int pgn = PAGING_PGN (addr);
   int off = PAGING_OFFST (addr);
@@ -292,11 +748,119 @@ pg_getval (struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   if (pg_getpage (mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
 
-  int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
+  addr_t phyaddr = PAGING_FRAME_ADDR (fpn) + off;
 
   return MEMPHY_read (caller->mram, phyaddr, data);
 }
 
+/*pg_getval_fast - read a resident page without the mm lock
+ *@mm: memory region
+ *@addr: virtual address to acess
+ *@data: data
+ *@caller: pcb
+ *
+ * Only the owner changes its page table, others take its resident PTEs
+ * down under mm_seq. A count found odd or moved once the byte is read
+ * means the frame may have been reused, return -1 for the locked path to
+ * retry, as for pages not resident or needing more than a lookup.
+ */
+static int
+pg_getval_fast (struct mm_struct *mm, addr_t addr, BYTE *data,
+                struct pcb_t *caller)
+{
+  struct framephy_struct *fp;
+  unsigned int seq;
+  pte_t pte;
+  int fpn;
+
+  seq = __atomic_load_n (&mm->mm_seq, __ATOMIC_ACQUIRE);
+  if (seq & 1)
+    return -1;
+
+  pte = pte_get (mm, PAGING_PGN (addr));
+  if (!PAGING_PAGE_PRESENT (pte) || (pte & PAGING_PTE_HUGE_MASK))
+    return -1;
+
+  fpn = PAGING_PTE_FPN (pte);
+  fp = &caller->mram->frmtbl[fpn];
+  if (__atomic_load_n (&fp->rabit, __ATOMIC_RELAXED))
+    return -1;
+
+  MEMPHY_read (caller->mram, PAGING_FRAME_ADDR (fpn) + PAGING_OFFST (addr),
+               data);
+
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (__atomic_load_n (&mm->mm_seq, __ATOMIC_RELAXED) != seq)
+    return -1;
+
+#ifdef MM_NUMA
+  /* Have the locked path check the owner and move it over, the frame is
+   * only touched through its atomic counters here */
+  if (MEMPHY_node (caller->mram, fpn) != caller->node
+      && __atomic_load_n (&fp->remote, __ATOMIC_RELAXED)
+             >= PAGING_NUMA_MIGRATE_HITS)
+    return -1;
+#endif
+
+  pg_touch (fpn, caller);
+
+  return 0;
+}
+
+/*pg_unshare - give a copy-on-write page its own frame
+ *@mm: memory region
+ *@pgn: PGN
+ *@fpn: return FPN
+ *@caller: caller
+ *
+ */
+static int
+pg_unshare (struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
+{
+  struct memphy_struct *mram = caller->mram;
+  int newfpn;
+
+  if (!(pte_get (mm, pgn) & PAGING_PTE_COW_MASK))
+    return 0;
+
+  /* Sole mapper left, the frame is ours */
+  if (*fpn != mram->zero_fpn && mram->frmtbl[*fpn].mapcount <= 1)
+    {
+      CLRBIT (*pte_ptr (mm, pgn), PAGING_PTE_COW_MASK);
+      return 0;
+    }
+
+  if (get_free_frame (caller, &newfpn) != 0)
+    return -1;
+
+  /* The eviction may have taken the shared page out */
+  if (pg_getpage (mm, pgn, fpn, caller) != 0)
+    {
+      MEMPHY_put_freefp (mram, newfpn);
+      return -1;
+    }
+
+  if (!(pte_get (mm, pgn) & PAGING_PTE_COW_MASK)
+      || (*fpn != mram->zero_fpn && mram->frmtbl[*fpn].mapcount <= 1))
+    { /* Came back from swap as a private page */
+      CLRBIT (*pte_ptr (mm, pgn), PAGING_PTE_COW_MASK);
+      MEMPHY_put_freefp (mram, newfpn);
+      return 0;
+    }
+
+  __swap_cp_page (mram, *fpn, mram, newfpn);
+
+  /* The other mappers may have taken their own copy meanwhile */
+  if (*fpn != mram->zero_fpn && MEMPHY_del_rmap (mram, *fpn, mm, pgn) == 0)
+    put_free_frame (mram, caller->active_mswp, *fpn);
+
+  pte_set_fpn (pte_ptr (mm, pgn), newfpn);
+  MEMPHY_set_rmap (mram, newfpn, mm, pgn);
+  *fpn = newfpn;
+
+  return 0;
+}
+
 /*pg_setval - write value to given offset
  *@mm: memory region
  *@addr: virtual address to acess
@@ -304,7 +868,8 @@ pg_getval (struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
  *
  */
 int
-pg_setval (struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
+pg_setval (struct mm_struct *mm, addr_t addr, BYTE value,
+           struct pcb_t *caller)
 {
   int pgn = PAGING_PGN (addr);
   int off = PAGING_OFFST (addr);
@@ -314,7 +879,16 @@ pg_setval (struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   if (pg_getpage (mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
 
-  int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
+  /* Shared pages are read-only, break the sharing before writing */
+  if (pg_unshare (mm, pgn, &fpn, caller) != 0)
+    return -1;
+
+  addr_t phyaddr = PAGING_FRAME_ADDR (fpn) + off;
+
+  /* The swap cache copy, if any, is stale from now on, pages under a huge
+   * mapping have no PTE of their own and never go to swap */
+  if (PAGING_PAGE_PRESENT (pte_get (mm, pgn)))
+    SETBIT (*pte_ptr (mm, pgn), PAGING_PTE_DIRTY_MASK);
 
   return MEMPHY_write (caller->mram, phyaddr, value);
 }
@@ -337,11 +911,16 @@ __read (struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
     return -1;
 
-  pthread_mutex_lock (caller->mlock);
+  /* Resident pages need no lock, faults go the slow way */
+  if (pg_getval_fast (caller->mm, currg->rg_start + offset, data, caller)
+      == 0)
+    return 0;
+
+  pthread_mutex_lock (&caller->mm->mm_lock);
 
   pg_getval (caller->mm, currg->rg_start + offset, data, caller);
 
-  pthread_mutex_unlock (caller->mlock);
+  pthread_mutex_unlock (&caller->mm->mm_lock);
 
   return 0;
 }
@@ -387,11 +966,11 @@ __write (struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
     return -1;
 
-  pthread_mutex_lock (caller->mlock);
+  pthread_mutex_lock (&caller->mm->mm_lock);
 
   pg_setval (caller->mm, currg->rg_start + offset, value, caller);
 
-  pthread_mutex_unlock (caller->mlock);
+  pthread_mutex_unlock (&caller->mm->mm_lock);
 
   return 0;
 }
@@ -423,28 +1002,81 @@ pgwrite (struct pcb_t *proc,   // Process executing the instruction
 int
 free_pcb_memph (struct pcb_t *caller)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  struct mm_struct *mm = caller->mm;
+  struct pgn_t *pg;
+  int dir, pagenum;
+  pte_t pte;
 
-  for (pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+  /* Only the allocated leaves of the page table are walked */
+  for (dir = mm->pgd_lo; dir < mm->pgd_hi; dir++)
     {
-      pte = caller->mm->pgd[pagenum];
+      if (mm->pgd[dir] == NULL)
+        continue;
 
-      if (!PAGING_PAGE_PRESENT (pte))
-        {
-          fpn = PAGING_FPN (pte);
-          MEMPHY_put_freefp (caller->mram, fpn);
-        }
-      else
+      for (pagenum = dir * PAGING_PTBL_LEAFSZ;
+           pagenum < (dir + 1) * PAGING_PTBL_LEAFSZ; pagenum++)
         {
-          fpn = PAGING_SWP (pte);
-          MEMPHY_put_freefp (caller->active_mswp, fpn);
+          pte = pte_get (mm, pagenum);
+
+          if (pte & PAGING_PTE_HUGE_MASK)
+            unmap_huge (caller->mram, mm, PAGING_PTE_FPN (pte));
+          else if (PAGING_PAGE_PRESENT (pte))
+            unmap_frame (caller->mram, caller->active_mswp,
+                         PAGING_PTE_FPN (pte), mm, pagenum);
+          else if (PAGING_PAGE_SWAPPED (pte))
+            put_swap_entry (caller->active_mswp, pte);
         }
+
+      free (mm->pgd[dir]);
+    }
+
+  free (mm->pgd);
+  mm->pgd = NULL;
+  mm->pgd_nr = 0;
+
+  while ((pg = mm->ws_list) != NULL)
+    {
+      mm->ws_list = pg->pg_next;
+      free (pg);
     }
 
   return 0;
 }
 
+/*swap_in_mm - bring back the working set of a resumed process
+ *@caller: the process, not running yet
+ *
+ * The pages evicted by swap_out_mm come back in one go, ahead of their
+ * faults, while MEMRAM stays above the kswapd high watermark: nothing is
+ * evicted for them. Return the number of pages brought back.
+ */
+int
+swap_in_mm (struct pcb_t *caller)
+{
+  struct mm_struct *mm = caller->mm;
+  int highmark = PAGING_KSWAPD_MARK (caller->mram, PAGING_KSWAPD_HIGHMARK);
+  struct pgn_t *pg;
+  pte_t pte;
+  int nr = 0;
+
+  pthread_mutex_lock (&mm->mm_lock);
+  while ((pg = mm->ws_list) != NULL)
+    {
+      mm->ws_list = pg->pg_next;
+      pte = pte_get (mm, pg->pgn);
+
+      if (!PAGING_PAGE_PRESENT (pte) && PAGING_PAGE_SWAPPED (pte)
+          && caller->mram->free_fpcnt > highmark
+          && pg_swapin (mm, pg->pgn, caller) == 0)
+        nr++;
+
+      free (pg);
+    }
+  pthread_mutex_unlock (&mm->mm_lock);
+
+  return nr;
+}
+
 /*get_vm_area_node - get vm area for a number of pages
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -510,17 +1142,13 @@ inc_vma_limit (struct pcb_t *caller, int vmaid, int inc_sz,
    * now will be alloc real ram region */
   cur_vma->vm_end += inc_amt;
 
-  pthread_mutex_lock (
-      caller->mlock); /* Locking physical memory access function */
-
+  /* The caller holds the mm lock */
   int map_ram_stat = vm_map_ram (caller, old_end, incnumpage, newrg);
 
 #ifdef MMDBG
-  print_list_rg (caller->mm->mmap->vm_freerg_list);
+  print_freerg (&caller->mm->mmap->vm_freerg);
 #endif
 
-  pthread_mutex_unlock (caller->mlock);
-
   if (map_ram_stat < 0)
     return -1;             /* Map the memory to MEMRAM */
 
@@ -529,34 +1157,113 @@ inc_vma_limit (struct pcb_t *caller, int vmaid, int inc_sz,
   return 0;
 }
 
-/*find_victim_page - find victim page
- *@caller: caller
- *@pgn: return page number
+/*frame_trylock_mappers - lock every mm mapping a frame, without waiting
+ *@mram: MEMRAM
+ *@fpn: frame number
  *
+ * Holding them all keeps the frame and its PTEs in place. Return -1, with
+ * nothing left locked, when one of them is busy.
  */
 int
-find_victim_page (struct mm_struct *mm, int *retpgn)
+frame_trylock_mappers (struct memphy_struct *mram, int fpn)
 {
-  struct pgn_t **pg = &mm->fifo_pgn;
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+  struct rmap_struct *rm, *busy;
 
-  /* Implement the FIFO mechanism to find the victim page */
-  if (*pg == NULL)
-    { /* No page has been allocated */
+  MEMPHY_lock (mram);
+
+  if (fp->owner == NULL || pthread_mutex_trylock (&fp->owner->mm_lock) != 0)
+    {
+      MEMPHY_unlock (mram);
       return -1;
     }
 
-  while ((*pg)->pg_next != NULL)
-    { /* Move to the last node */
-      pg = &((*pg)->pg_next);
+  for (busy = fp->rmap_list; busy != NULL; busy = busy->rm_next)
+    if (pthread_mutex_trylock (&busy->mm->mm_lock) != 0)
+      break;
+
+  if (busy != NULL)
+    { /* Back off, release what was taken */
+      for (rm = fp->rmap_list; rm != busy; rm = rm->rm_next)
+        pthread_mutex_unlock (&rm->mm->mm_lock);
+      pthread_mutex_unlock (&fp->owner->mm_lock);
+      MEMPHY_unlock (mram);
+      return -1;
     }
 
-  struct pgn_t *free_node = *pg; /* Temporarily node */
+  MEMPHY_unlock (mram);
 
-  *pg = NULL;                    /* Resetting the previous last node to NULL */
+  return 0;
+}
 
-  free (free_node);              /* Free the last node */
+/*frame_unlock_mappers - unlock every mm mapping a frame
+ *@mram: MEMRAM
+ *@fpn: frame number
+ */
+void
+frame_unlock_mappers (struct memphy_struct *mram, int fpn)
+{
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+  struct rmap_struct *rm;
 
-  return 0;
+  for (rm = fp->rmap_list; rm != NULL; rm = rm->rm_next)
+    pthread_mutex_unlock (&rm->mm->mm_lock);
+  pthread_mutex_unlock (&fp->owner->mm_lock);
+}
+
+/*find_victim_page - find victim page among all processes
+ *@mram: MEMRAM whose frame table is scanned
+ *@memcg: group the victim must belong to, NULL for any
+ *@vicmm: return owner of the victim page
+ *@retpgn: return page number of the victim in its owner
+ *@retfpn: return frame number holding the victim
+ *
+ * The victim is returned with all its mappers locked. Return -1 when no
+ * page is mapped, 1 when every candidate belongs to a busy process.
+ */
+int
+find_victim_page (struct memphy_struct *mram, struct memcg_struct *memcg,
+                  struct mm_struct **vicmm, int *retpgn, int *retfpn)
+{
+  struct framephy_struct *fp;
+  int scan, nrbusy = 0;
+
+  MEMPHY_lock (mram);
+
+  /* Implement the CLOCK mechanism over the global frame table, two
+   * rounds of the hand are enough to meet an unreferenced frame */
+  for (scan = 0; scan < 2 * mram->maxfpn; scan++)
+    {
+      fp = &mram->frmtbl[mram->clock_hand];
+      mram->clock_hand = (mram->clock_hand + 1) % mram->maxfpn;
+
+      if (fp->owner == NULL)
+        continue; /* Free frame or not mapped yet */
+
+      if (memcg != NULL && fp->owner->memcg != memcg)
+        continue; /* Left alone, with its second chance */
+
+      if (__atomic_exchange_n (&fp->refbit, 0, __ATOMIC_RELAXED))
+        continue; /* Recently used, give it a second chance */
+
+      if (frame_trylock_mappers (mram, fp->fpn) != 0)
+        { /* Its process is in the middle of a memory access */
+          nrbusy++;
+          continue;
+        }
+
+      *vicmm = fp->owner;
+      *retpgn = fp->pgn;
+      *retfpn = fp->fpn;
+      MEMPHY_unlock (mram);
+
+      return 0;
+    }
+
+  MEMPHY_unlock (mram);
+
+  /* No page has been mapped */
+  return (nrbusy > 0) ? 1 : -1;
 }
 
 /*get_free_vmrg_area - get a free vm region
@@ -571,60 +1278,11 @@ get_free_vmrg_area (struct pcb_t *caller, int vmaid, int size,
 {
   struct vm_area_struct *cur_vma = get_vma_by_num (caller->mm, vmaid);
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-
-  if (rgit == NULL)
+  if (cur_vma == NULL)
     return -1;
 
-  /* Probe unintialized newrg */
-  newrg->rg_start = newrg->rg_end = -1;
-
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL)
-    {
-      if (rgit->rg_start + size <= rgit->rg_end)
-        { /* Current region has enough space */
-          newrg->rg_start = rgit->rg_start;
-          newrg->rg_end = rgit->rg_start + size;
-
-          /* Update left space in chosen region */
-          if (rgit->rg_start + size < rgit->rg_end)
-            {
-              rgit->rg_start = rgit->rg_start + size;
-            }
-          else
-            { /*Use up all space, remove current node */
-              /*Clone next rg node */
-              struct vm_rg_struct *nextrg = rgit->rg_next;
-
-              /*Cloning */
-              if (nextrg != NULL)
-                {
-                  rgit->rg_start = nextrg->rg_start;
-                  rgit->rg_end = nextrg->rg_end;
-
-                  rgit->rg_next = nextrg->rg_next;
-
-                  free (nextrg);
-                }
-              else
-                {                                /*End of free list */
-                  rgit->rg_start = rgit->rg_end; // dummy, size 0 region
-                  rgit->rg_next = NULL;
-                }
-            }
-          break;
-        }
-      else
-        {
-          rgit = rgit->rg_next; // Traverse next rg
-        }
-    }
-
-  if (newrg->rg_start == -1) // new region not found
-    return -1;
-
-  return 0;
+  /* Best fit over the size class bins */
+  return freerg_alloc (&cur_vma->vm_freerg, size, newrg);
 }
 
 // #endif
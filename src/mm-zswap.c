@@ -0,0 +1,433 @@
+// #ifdef MM_ZSWAP
+/*
+ * PAGING based Memory Management
+ * Compressed swap cache mm/mm-zswap.c
+ */
+
+#include "mm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * A pool of host memory holding evicted pages in compressed form. Entries
+ * are found through the PTE (swap type PAGING_ZSWAP_SWPTYP, swap offset =
+ * entry index) and keep a reverse map to their owner so that the oldest
+ * ones can be written back to the swap device when the pool is full.
+ */
+struct zswap_entry
+{
+  BYTE *data;
+  int len;
+
+  struct mm_struct *owner;
+  int pgn;
+  int heat; /* of the page when stored */
+
+  /* Store order, oldest first */
+  int prev;
+  int next;
+};
+
+static struct zswap_entry zswap_tbl[PAGING_ZSWAP_MAXENT];
+static int zswap_freeidx[PAGING_ZSWAP_MAXENT];
+static int zswap_nrfree = -1;
+static int zswap_oldest = -1;
+static int zswap_newest = -1;
+static int zswap_poolsz;
+
+/* Guards the pool, taken after the mm lock of the caller and before the
+ * device locks. The owner of an entry written back is only trylocked, the
+ * pool lock is not held across the write itself */
+static pthread_mutex_t zswap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Statistics */
+static unsigned long zswap_nrstored;
+static unsigned long zswap_nrwriteback;
+static unsigned long zswap_nrreject;
+
+/*
+ *  zswap_init - lazily set up the entry table
+ */
+static void
+zswap_init (void)
+{
+  int it;
+
+  if (zswap_nrfree >= 0)
+    return;
+
+  for (it = 0; it < PAGING_ZSWAP_MAXENT; it++)
+    zswap_freeidx[it] = PAGING_ZSWAP_MAXENT - 1 - it;
+  zswap_nrfree = PAGING_ZSWAP_MAXENT;
+}
+
+/*
+ *  zswap_compress - run-length encode a page as (count, byte) pairs
+ *  @src: page content
+ *  @dst: output buffer of PAGING_PAGESZ bytes
+ *
+ *  Return the compressed size, or -1 when the page does not shrink.
+ */
+static int
+zswap_compress (const BYTE *src, BYTE *dst)
+{
+  int it = 0, len = 0, run;
+
+  while (it < PAGING_PAGESZ)
+    {
+      run = 1;
+      while (it + run < PAGING_PAGESZ && src[it + run] == src[it] && run < 255)
+        run++;
+
+      if (len + 2 >= PAGING_PAGESZ)
+        return -1;
+
+      dst[len++] = (BYTE)run;
+      dst[len++] = src[it];
+      it += run;
+    }
+
+  return len;
+}
+
+/*
+ *  zswap_decompress - expand a run-length encoded page
+ *  @src: compressed content
+ *  @len: compressed size
+ *  @dst: output page
+ */
+static void
+zswap_decompress (const BYTE *src, int len, BYTE *dst)
+{
+  int it, run, out = 0;
+
+  for (it = 0; it + 1 < len; it += 2)
+    {
+      run = (unsigned char)src[it];
+      while (run-- > 0 && out < PAGING_PAGESZ)
+        dst[out++] = src[it + 1];
+    }
+}
+
+/*
+ *  zswap_detach - take an entry out of the store order
+ *  @idx: entry index
+ *
+ *  Its compressed size no longer counts against the pool.
+ */
+static void
+zswap_detach (int idx)
+{
+  struct zswap_entry *ent = &zswap_tbl[idx];
+
+  if (ent->prev >= 0)
+    zswap_tbl[ent->prev].next = ent->next;
+  else
+    zswap_oldest = ent->next;
+
+  if (ent->next >= 0)
+    zswap_tbl[ent->next].prev = ent->prev;
+  else
+    zswap_newest = ent->prev;
+
+  zswap_poolsz -= ent->len;
+}
+
+/*
+ *  zswap_reattach - put a detached entry back as the oldest one
+ *  @idx: entry index
+ */
+static void
+zswap_reattach (int idx)
+{
+  struct zswap_entry *ent = &zswap_tbl[idx];
+
+  ent->prev = -1;
+  ent->next = zswap_oldest;
+  if (zswap_oldest >= 0)
+    zswap_tbl[zswap_oldest].prev = idx;
+  else
+    zswap_newest = idx;
+  zswap_oldest = idx;
+
+  zswap_poolsz += ent->len;
+}
+
+/*
+ *  zswap_free - release a detached entry
+ *  @idx: entry index
+ */
+static void
+zswap_free (int idx)
+{
+  struct zswap_entry *ent = &zswap_tbl[idx];
+
+  free (ent->data);
+  ent->data = NULL;
+  ent->owner = NULL;
+
+  zswap_freeidx[zswap_nrfree++] = idx;
+}
+
+/*
+ *  zswap_unlink - drop an entry from the store order and release it
+ *  @idx: entry index
+ */
+static void
+zswap_unlink (int idx)
+{
+  zswap_detach (idx);
+  zswap_free (idx);
+}
+
+/*
+ *  zswap_writeback_entry - spill an entry to a swap device
+ *  @idx: entry index
+ *  @mswp: swap devices
+ *  @retswptyp: return the device now holding the page
+ *  @retoff: return its swap slot
+ *
+ *  Called with the pool locked. The entry is detached and the pool lock
+ *  dropped while the page is decompressed and written, its owner stays
+ *  locked throughout so that nobody else reaches the entry meanwhile.
+ */
+static int
+zswap_writeback_entry (int idx, struct memphy_struct *mswp, int *retswptyp,
+                       int *retoff)
+{
+  BYTE page[PAGING_MAX_PAGESZ];
+  struct zswap_entry *ent = &zswap_tbl[idx];
+  struct mm_struct *owner = ent->owner;
+  struct memphy_struct *dev;
+  int swptyp, swpfpn;
+
+  /* The owner PTE changes, its process must not be using it */
+  if (pthread_mutex_trylock (&owner->mm_lock) != 0)
+    return -1;
+
+  zswap_detach (idx);
+  pthread_mutex_unlock (&zswap_lock);
+
+  if (swap_alloc (mswp, 1, &swptyp, &swpfpn) != 0)
+    {
+      pthread_mutex_lock (&zswap_lock);
+      zswap_reattach (idx);
+      pthread_mutex_unlock (&owner->mm_lock);
+      return -1;
+    }
+  dev = swap_dev (mswp, swptyp);
+
+  zswap_decompress (ent->data, ent->len, page);
+#ifdef MM_BLK
+  blk_submit_write (dev, swpfpn, page);
+#else
+  MEMPHY_write_frame (dev, swpfpn, page);
+#endif
+  dev->nr_wrpg++;
+  swap_set_owner (dev, swpfpn, owner, ent->pgn, ent->heat);
+
+  /* Redirect the owner PTE to the device */
+  pte_set_swap (pte_ptr (owner, ent->pgn), swptyp, swpfpn);
+
+  pthread_mutex_lock (&zswap_lock);
+  zswap_free (idx);
+  zswap_nrwriteback++;
+  pthread_mutex_unlock (&owner->mm_lock);
+
+  *retswptyp = swptyp;
+  *retoff = swpfpn;
+
+  return 0;
+}
+
+/*
+ *  zswap_writeback - spill the oldest entry to a swap device
+ *  @mswp: swap devices
+ */
+static int
+zswap_writeback (struct memphy_struct *mswp)
+{
+  int swptyp, swpoff;
+
+  if (zswap_oldest < 0)
+    return -1;
+
+  return zswap_writeback_entry (zswap_oldest, mswp, &swptyp, &swpoff);
+}
+
+/*
+ *  zswap_evict - move an entry out of the pool to a swap device
+ *  @off: entry index
+ *  @mswp: swap devices
+ *  @retswptyp: return the device now holding the page
+ *  @retoff: return its swap slot
+ *
+ *  Used when the page is about to get a second owner, an entry has one.
+ */
+int
+zswap_evict (int off, struct memphy_struct *mswp, int *retswptyp, int *retoff)
+{
+  int ret = -1;
+
+  pthread_mutex_lock (&zswap_lock);
+  if (off >= 0 && off < PAGING_ZSWAP_MAXENT && zswap_tbl[off].data != NULL)
+    ret = zswap_writeback_entry (off, mswp, retswptyp, retoff);
+  pthread_mutex_unlock (&zswap_lock);
+
+  return ret;
+}
+
+/*
+ *  zswap_store - compress a MEMRAM frame into the pool
+ *  @mram: MEMRAM holding the page
+ *  @fpn: frame number
+ *  @mswp: swap devices receiving the written back entries
+ *  @owner: mm owning the page
+ *  @pgn: page number inside owner
+ *  @retoff: return the entry index, to be stored as PTE swap offset
+ */
+int
+zswap_store (struct memphy_struct *mram, int fpn, struct memphy_struct *mswp,
+             struct mm_struct *owner, int pgn, int *retoff)
+{
+  BYTE page[PAGING_MAX_PAGESZ], buf[PAGING_MAX_PAGESZ];
+  struct zswap_entry *ent;
+  int it, len, idx, poolsz;
+
+  /* Compress before taking the pool */
+  MEMPHY_read_frame (mram, fpn, page);
+
+  len = zswap_compress (page, buf);
+
+  /* A small MEMRAM gets a small pool */
+  poolsz = PAGING_ZSWAP_POOLSZ;
+  if (mram->maxsz * PAGING_ZSWAP_POOLPCT / 100 < (addr_t)poolsz)
+    poolsz = mram->maxsz * PAGING_ZSWAP_POOLPCT / 100;
+
+  pthread_mutex_lock (&zswap_lock);
+  zswap_init ();
+
+  if (len < 0)
+    { /* Incompressible, it goes straight to the swap device */
+      zswap_nrreject++;
+      pthread_mutex_unlock (&zswap_lock);
+      return -1;
+    }
+
+  /* Make room by spilling the oldest entries to the real device */
+  while (zswap_nrfree == 0 || zswap_poolsz + len > poolsz)
+    if (zswap_writeback (mswp) != 0)
+      {
+        pthread_mutex_unlock (&zswap_lock);
+        return -1;
+      }
+
+  idx = zswap_freeidx[--zswap_nrfree];
+  ent = &zswap_tbl[idx];
+  ent->data = malloc (len);
+  for (it = 0; it < len; it++)
+    ent->data[it] = buf[it];
+  ent->len = len;
+  ent->owner = owner;
+  ent->pgn = pgn;
+  ent->heat = __atomic_load_n (&mram->frmtbl[fpn].heat, __ATOMIC_RELAXED);
+
+  ent->next = -1;
+  ent->prev = zswap_newest;
+  if (zswap_newest >= 0)
+    zswap_tbl[zswap_newest].next = idx;
+  else
+    zswap_oldest = idx;
+  zswap_newest = idx;
+
+  zswap_poolsz += len;
+  zswap_nrstored++;
+  *retoff = idx;
+  pthread_mutex_unlock (&zswap_lock);
+
+  return 0;
+}
+
+/*
+ *  zswap_load - decompress an entry into a MEMRAM frame and release it
+ *  @off: entry index
+ *  @mram: MEMRAM
+ *  @fpn: destination frame
+ */
+int
+zswap_load (int off, struct memphy_struct *mram, int fpn)
+{
+  BYTE page[PAGING_MAX_PAGESZ];
+
+  pthread_mutex_lock (&zswap_lock);
+  if (off < 0 || off >= PAGING_ZSWAP_MAXENT || zswap_tbl[off].data == NULL)
+    {
+      pthread_mutex_unlock (&zswap_lock);
+      return -1;
+    }
+
+  zswap_decompress (zswap_tbl[off].data, zswap_tbl[off].len, page);
+  __atomic_store_n (&mram->frmtbl[fpn].heat, zswap_tbl[off].heat,
+                    __ATOMIC_RELAXED);
+  zswap_unlink (off);
+  pthread_mutex_unlock (&zswap_lock);
+
+  return MEMPHY_write_frame (mram, fpn, page);
+}
+
+/*
+ *  zswap_invalidate - drop an entry whose page has been freed
+ *  @off: entry index
+ */
+int
+zswap_invalidate (int off)
+{
+  int ret = -1;
+
+  pthread_mutex_lock (&zswap_lock);
+  if (off >= 0 && off < PAGING_ZSWAP_MAXENT && zswap_tbl[off].data != NULL)
+    {
+      zswap_unlink (off);
+      ret = 0;
+    }
+  pthread_mutex_unlock (&zswap_lock);
+
+  return ret;
+}
+
+/*
+ *  zswap_release - drop every entry still owned by an exiting mm
+ *  @mm: mm about to be freed
+ *
+ *  Its swap entries are gone already, this only makes sure that writeback
+ *  can no longer reach the mm. Return the number of entries dropped.
+ */
+int
+zswap_release (struct mm_struct *mm)
+{
+  int idx, nr = 0;
+
+  pthread_mutex_lock (&zswap_lock);
+  for (idx = 0; idx < PAGING_ZSWAP_MAXENT; idx++)
+    if (zswap_tbl[idx].data != NULL && zswap_tbl[idx].owner == mm)
+      {
+        zswap_unlink (idx);
+        nr++;
+      }
+  pthread_mutex_unlock (&zswap_lock);
+
+  return nr;
+}
+
+int
+zswap_dump (void)
+{
+  printf ("ZSWAP: %lu pages stored, %lu written back, %lu rejected, "
+          "%d bytes in pool\n",
+          zswap_nrstored, zswap_nrwriteback, zswap_nrreject, zswap_poolsz);
+
+  return 0;
+}
+
+// #endif
@@ -5,14 +5,47 @@
  */
 
 #include "mm.h"
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+int paging_pagesz = PAGING_DEFAULT_PAGESZ;
+int paging_pgshift = 8;
+int paging_huge_nr = 1;
+
+/*
+ * paging_setup - set the page geometry, before any memphy is formatted
+ * @pagesz     : page size, a power of two
+ * @huge_order : a huge page maps 2^huge_order frames, 0 disables them
+ */
+int
+paging_setup (int pagesz, int huge_order)
+{
+  int shift = 0;
+
+  if (pagesz < PAGING_MIN_PAGESZ || pagesz > PAGING_MAX_PAGESZ
+      || (pagesz & (pagesz - 1)) != 0)
+    return -1;
+
+  if (huge_order < 0 || huge_order > PAGING_MAX_HUGE_ORDER)
+    return -1;
+
+  while ((1 << shift) < pagesz)
+    shift++;
+
+  paging_pagesz = pagesz;
+  paging_pgshift = shift;
+  paging_huge_nr = 1 << huge_order;
+
+  return 0;
+}
+
 /*
  * init_pte - Initialize PTE entry
  */
 int
-init_pte (uint32_t *pte,
+init_pte (pte_t *pte,
           int pre,    // present
           int fpn,    // FPN
           int drt,    // dirty
@@ -20,36 +53,139 @@ init_pte (uint32_t *pte,
           int swptyp, // swap type
           int swpoff) // swap offset
 {
+  pte_t val = *pte;
+
   if (pre != 0)
     {
       if (swp == 0)
         {              // Non swap ~ page online
-          if (fpn == 0)
+          if (fpn < 0)
             return -1; // Invalid setting
 
           /* Valid setting with FPN */
-          SETBIT (*pte, PAGING_PTE_PRESENT_MASK);
-          CLRBIT (*pte, PAGING_PTE_SWAPPED_MASK);
-          CLRBIT (*pte, PAGING_PTE_DIRTY_MASK);
+          SETBIT (val, PAGING_PTE_PRESENT_MASK);
+          CLRBIT (val, PAGING_PTE_SWAPPED_MASK);
+          CLRBIT (val, PAGING_PTE_DIRTY_MASK);
+          CLRBIT (val, PAGING_PTE_COW_MASK);
+          CLRBIT (val, PAGING_PTE_HUGE_MASK);
 
-          SETVAL (*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+          SETVAL (val, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
         }
       else
         { // page swapped
-          SETBIT (*pte, PAGING_PTE_PRESENT_MASK);
-          SETBIT (*pte, PAGING_PTE_SWAPPED_MASK);
-          CLRBIT (*pte, PAGING_PTE_DIRTY_MASK);
+          SETBIT (val, PAGING_PTE_PRESENT_MASK);
+          SETBIT (val, PAGING_PTE_SWAPPED_MASK);
+          CLRBIT (val, PAGING_PTE_DIRTY_MASK);
 
-          SETVAL (*pte, swptyp, PAGING_PTE_SWPTYP_MASK,
+          SETVAL (val, swptyp, PAGING_PTE_SWPTYP_MASK,
                   PAGING_PTE_SWPTYP_LOBIT);
-          SETVAL (*pte, swpoff, PAGING_PTE_SWPOFF_MASK,
+          SETVAL (val, swpoff, PAGING_PTE_SWPOFF_MASK,
                   PAGING_PTE_SWPOFF_LOBIT);
         }
     }
 
+  pte_store (pte, val);
+
   return 0;
 }
 
+/*
+ * mm_seq_begin - start taking down a resident PTE of another process
+ * @mm : mm owning the PTE, locked by the caller
+ *
+ * The owner reads its resident pages without the lock, see pg_getval_fast.
+ * It retries under the lock when the count is odd or has moved meanwhile.
+ */
+void
+mm_seq_begin (struct mm_struct *mm)
+{
+  __atomic_store_n (&mm->mm_seq, mm->mm_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+/*
+ * mm_seq_end - done with the PTEs, the frames may be reused from now on
+ * @mm : mm owning the PTE, locked by the caller
+ */
+void
+mm_seq_end (struct mm_struct *mm)
+{
+  __atomic_store_n (&mm->mm_seq, mm->mm_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * pte_get - read the PTE of a page
+ * @mm  : mm owning the page table
+ * @pgn : page number
+ *
+ * Pages under a leaf not allocated yet read as an empty PTE.
+ */
+pte_t
+pte_get (struct mm_struct *mm, int pgn)
+{
+  pte_t *leaf;
+
+  if (pgn < 0 || PAGING_PTBL_DIR (pgn) >= mm->pgd_nr)
+    return 0;
+
+  leaf = mm->pgd[PAGING_PTBL_DIR (pgn)];
+  if (leaf == NULL)
+    return 0;
+
+  return __atomic_load_n (&leaf[PAGING_PTBL_IDX (pgn)], __ATOMIC_RELAXED);
+}
+
+/*
+ * pte_store - write a PTE in one go
+ * @pte : PTE, its mm locked by the caller
+ * @val : new value
+ *
+ * The owner reads its PTEs without the lock while another process may be
+ * updating them, so they are never seen half written.
+ */
+void
+pte_store (pte_t *pte, pte_t val)
+{
+  __atomic_store_n (pte, val, __ATOMIC_RELAXED);
+}
+
+/*
+ * pte_ptr - get the PTE of a page for update, allocating its leaf
+ * @mm  : mm owning the page table
+ * @pgn : page number
+ */
+pte_t *
+pte_ptr (struct mm_struct *mm, int pgn)
+{
+  int dir = PAGING_PTBL_DIR (pgn);
+  int nr;
+
+  if (dir >= mm->pgd_nr)
+    { /* Grow the directory to cover the leaf, doubling its size */
+      for (nr = (mm->pgd_nr > 0) ? mm->pgd_nr : 1; nr <= dir; nr *= 2)
+        ;
+      if (nr > PAGING_PTBL_DIRSZ)
+        nr = PAGING_PTBL_DIRSZ;
+
+      mm->pgd = realloc (mm->pgd, nr * sizeof (pte_t *));
+      while (mm->pgd_nr < nr)
+        mm->pgd[mm->pgd_nr++] = NULL;
+    }
+
+  if (mm->pgd[dir] == NULL)
+    {
+      mm->pgd[dir] = calloc (PAGING_PTBL_LEAFSZ, sizeof (pte_t));
+
+      /* Keep the range of allocated leaves for the page table walks */
+      if (dir < mm->pgd_lo)
+        mm->pgd_lo = dir;
+      if (dir >= mm->pgd_hi)
+        mm->pgd_hi = dir + 1;
+    }
+
+  return &mm->pgd[dir][PAGING_PTBL_IDX (pgn)];
+}
+
 /*
  * pte_set_swap - Set PTE entry for swapped page
  * @pte    : target page table entry (PTE)
@@ -57,13 +193,16 @@ init_pte (uint32_t *pte,
  * @swpoff : swap offset
  */
 int
-pte_set_swap (uint32_t *pte, int swptyp, int swpoff)
+pte_set_swap (pte_t *pte, int swptyp, int swpoff)
 {
-  CLRBIT (*pte, PAGING_PTE_PRESENT_MASK);
-  SETBIT (*pte, PAGING_PTE_SWAPPED_MASK);
+  pte_t val = *pte;
+
+  CLRBIT (val, PAGING_PTE_PRESENT_MASK);
+  SETBIT (val, PAGING_PTE_SWAPPED_MASK);
 
-  SETVAL (*pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
-  SETVAL (*pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+  SETVAL (val, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+  SETVAL (val, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+  pte_store (pte, val);
 
   return 0;
 }
@@ -74,12 +213,17 @@ pte_set_swap (uint32_t *pte, int swptyp, int swpoff)
  * @fpn   : frame page number (FPN)
  */
 int
-pte_set_fpn (uint32_t *pte, int fpn)
+pte_set_fpn (pte_t *pte, int fpn)
 {
-  SETBIT (*pte, PAGING_PTE_PRESENT_MASK);
-  CLRBIT (*pte, PAGING_PTE_SWAPPED_MASK);
+  pte_t val = *pte;
 
-  SETVAL (*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  SETBIT (val, PAGING_PTE_PRESENT_MASK);
+  CLRBIT (val, PAGING_PTE_SWAPPED_MASK);
+  CLRBIT (val, PAGING_PTE_COW_MASK);
+  CLRBIT (val, PAGING_PTE_HUGE_MASK);
+
+  SETVAL (val, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  pte_store (pte, val);
 
   return 0;
 }
@@ -90,12 +234,12 @@ pte_set_fpn (uint32_t *pte, int fpn)
 int
 vmap_page_range (
     struct pcb_t *caller,           // process call
-    int addr,                       // start address which is aligned to pagesz
+    addr_t addr,                    // start address which is aligned to pagesz
     int pgnum,                      // num of mapping page
     struct framephy_struct *frames, // list of the mapped frames
     struct vm_rg_struct *ret_rg)    // return mapped region, the real mapped fp
 {                                   // no guarantee all given pages are mapped
-  uint32_t *pte;
+  pte_t *pte;
   struct framephy_struct *fpit = frames;
   int pgit;
   int pgn = PAGING_PGN (addr);
@@ -115,7 +259,19 @@ vmap_page_range (
         return -2;
 
       /* Get the address of caller->mm->pgd[pgn + pgit] */
-      pte = &caller->mm->pgd[pgn + pgit];
+      pte = pte_ptr (caller->mm, pgn + pgit);
+
+      if (fpit == NULL)
+        { /* No frame given, the page reads as zero through the shared
+           * zero frame until its first write */
+          init_pte (pte, /* present: */ 1, /* fpn: */ caller->mram->zero_fpn,
+                    /* drt: */ 0, /* swp: */ 0, /* swptyp */ 0,
+                    /*  swpoff */ 0);
+          SETBIT (*pte, PAGING_PTE_COW_MASK);
+          mm_charge (caller->mm, 1);
+          ret_rg->rg_end += PAGING_PAGESZ;
+          continue;
+        }
 
       /* Page table entry for each frame,
        * initially every frame is presented */
@@ -123,21 +279,909 @@ vmap_page_range (
                 /* swp: */ 0, /* swptyp */ 0, /*  swpoff */ 0);
 #ifdef MMDBG
 
-      printf ("\t[ALLOC] PID=%d page_entry=%08x frame_number%d\n", caller->pid,
-              *pte, fpit->fpn);
+      printf ("\t[ALLOC] PID=%d page_entry=%016llx frame_number%d\n",
+              caller->pid, *pte, fpit->fpn);
 #endif
 
+      /* Tracking for later page replacement activities
+       * through the reverse map of the frame table */
+      MEMPHY_set_rmap (caller->mram, fpit->fpn, caller->mm, pgn + pgit);
+      mm_charge (caller->mm, 1);
+
       fpit = fpit->fp_next;            /* proceed to the next physical frame */
       ret_rg->rg_end += PAGING_PAGESZ; /* Add page end to one page size */
+    }
+
+  return 0;
+}
+
+#if MM_SWAP_POLICY == SWAP_STRIPE
+/* Device taking the next striped allocation */
+static int swap_rr;
+#endif
+
+/*
+ * swap_dev - device of a swap type
+ * @mswp   : swap devices, PAGING_MAX_MMSWP of them
+ * @swptyp : PTE swap type, the device number
+ */
+struct memphy_struct *
+swap_dev (struct memphy_struct *mswp, int swptyp)
+{
+  if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP)
+    return NULL;
+
+  return &mswp[swptyp];
+}
+
+/*
+ * swap_get_slots - reserve contiguous slots on a single device
+ * @mswp      : swap devices
+ * @mintyp    : first device eligible
+ * @num       : number of slots
+ * @retswptyp : return the device number
+ * @retswpoff : return the first slot
+ *
+ * Striped, the devices take turns. Tiered, the lowest numbered and fastest
+ * device with room is used.
+ */
+static int
+swap_get_slots (struct memphy_struct *mswp, int mintyp, int num,
+                int *retswptyp, int *retswpoff)
+{
+  int start = 0, it, typ;
+
+#if MM_SWAP_POLICY == SWAP_STRIPE
+  start = __atomic_fetch_add (&swap_rr, 1, __ATOMIC_RELAXED);
+#endif
+
+  for (it = 0; it < PAGING_MAX_MMSWP; it++)
+    {
+      typ = (start + it) % PAGING_MAX_MMSWP;
+      if (typ < mintyp || mswp[typ].maxfpn == 0)
+        continue;
+
+      if (MEMPHY_get_freefp_range (&mswp[typ], num, retswpoff) == 0)
+        {
+          *retswptyp = typ;
+          return 0;
+        }
+    }
+
+  return -1;
+}
+
+/*
+ * swap_alloc - reserve contiguous slots on one of the swap devices
+ * @mswp      : swap devices
+ * @num       : number of slots
+ * @retswptyp : return the device number, to be stored as PTE swap type
+ * @retswpoff : return the first slot
+ */
+int
+swap_alloc (struct memphy_struct *mswp, int num, int *retswptyp,
+            int *retswpoff)
+{
+  return swap_get_slots (mswp, 0, num, retswptyp, retswpoff);
+}
+
+/*
+ * swap_put_slot - drop one user of a swap slot
+ * @mswp   : swap device
+ * @swpoff : swap slot
+ *
+ * A slot is used by every PTE swapped out to it and by the frame keeping
+ * it as swap cache, it goes back to the free list with the last user.
+ */
+static int
+swap_put_slot (struct memphy_struct *mswp, int swpoff)
+{
+  int ret = 0;
+
+  if (swpoff < 0 || swpoff >= mswp->maxfpn)
+    return -1;
+
+  MEMPHY_lock (mswp);
+  if (--mswp->frmtbl[swpoff].mapcount <= 0)
+    ret = MEMPHY_put_freefp (mswp, swpoff);
+  MEMPHY_unlock (mswp);
+
+  return ret;
+}
+
+/*
+ * swap_set_owner - hand a swap slot to the page it holds
+ * @dev    : swap device
+ * @swpoff : slot
+ * @mm     : mm of the page
+ * @pgn    : page number
+ * @heat   : heat of the page, kept for tiering
+ */
+void
+swap_set_owner (struct memphy_struct *dev, int swpoff, struct mm_struct *mm,
+                int pgn, int heat)
+{
+  MEMPHY_lock (dev);
+  MEMPHY_set_rmap (dev, swpoff, mm, pgn);
+  dev->frmtbl[swpoff].heat = heat;
+  MEMPHY_unlock (dev);
+}
+
+/*
+ * swap_unmap_pte - turn a resident PTE into a swap entry
+ * @mm     : mm owning the PTE
+ * @pgn    : page number
+ * @swptyp : swap type
+ * @swpoff : swap offset
+ */
+static void
+swap_unmap_pte (struct mm_struct *mm, int pgn, int swptyp, int swpoff)
+{
+  pte_t *pte = pte_ptr (mm, pgn);
+
+  mm_seq_begin (mm);
+  pte_set_swap (pte, swptyp, swpoff);
+  pte_store (pte, *pte & ~(PAGING_PTE_DIRTY_MASK | PAGING_PTE_COW_MASK));
+  mm_seq_end (mm);
+  mm_charge (mm, -1);
+#ifdef MM_MEMCG
+  if (mm->memcg != NULL)
+    __atomic_fetch_add (&mm->memcg->nr_swapout, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+ * swap_out_shared - evict a frame mapped by several PTEs
+ * @mram : MEMRAM
+ * @mswp : swap devices
+ * @fpn  : frame number, its mappers locked
+ *
+ * Every mapper is redirected to a single swap slot, used once per mapper,
+ * and unlocked.
+ */
+static int
+swap_out_shared (struct memphy_struct *mram, struct memphy_struct *mswp,
+                 int fpn)
+{
+  struct framephy_struct *fp = &mram->frmtbl[fpn];
+  struct rmap_struct *rm;
+  struct memphy_struct *dev;
+  pte_t dirty;
+  int swptyp, swpoff;
+
+  dirty = pte_get (fp->owner, fp->pgn) & PAGING_PTE_DIRTY_MASK;
+  for (rm = fp->rmap_list; rm != NULL; rm = rm->rm_next)
+    dirty |= pte_get (rm->mm, rm->pgn) & PAGING_PTE_DIRTY_MASK;
+
+  if (fp->swpoff >= 0)
+    {
+      swptyp = fp->swptyp;
+      swpoff = fp->swpoff;
+      dev = swap_dev (mswp, swptyp);
+      if (dirty)
+        __swap_cp_page (mram, fpn, dev, swpoff);
+    }
+  else
+    {
+      if (swap_alloc (mswp, 1, &swptyp, &swpoff) != 0)
+        {
+          frame_unlock_mappers (mram, fpn);
+          return -1;
+        }
+      dev = swap_dev (mswp, swptyp);
+      __swap_cp_page (mram, fpn, dev, swpoff);
+    }
+
+  /* Several users, the slot has no owner to demote it for */
+  MEMPHY_lock (dev);
+  dev->frmtbl[swpoff].owner = NULL;
+  dev->frmtbl[swpoff].mapcount = fp->mapcount;
+  dev->frmtbl[swpoff].heat = __atomic_load_n (&fp->heat, __ATOMIC_RELAXED);
+  MEMPHY_unlock (dev);
+
+  swap_unmap_pte (fp->owner, fp->pgn, swptyp, swpoff);
+  for (rm = fp->rmap_list; rm != NULL; rm = rm->rm_next)
+    swap_unmap_pte (rm->mm, rm->pgn, swptyp, swpoff);
+  frame_unlock_mappers (mram, fpn);
+
+  fp->swpoff = -1;
+  MEMPHY_set_rmap (mram, fpn, NULL, -1);
 
-      /* Tracking for later page replacement activities (if needed)
-       * Enqueue new usage page */
-      enlist_pgn_node (&caller->mm->fifo_pgn, pgn + pgit);
+  return 0;
+}
+
+/*
+ * swap_out_locked - evict a page
+ * @mram   : MEMRAM to take the frame from
+ * @mswp   : swap devices receiving the victim
+ * @vicmm  : owner of the victim
+ * @vicpgn : page number of the victim in its owner
+ * @vicfpn : frame holding the victim, all its mappers locked
+ * @retfpn : return the MEMRAM frame released by the eviction
+ *
+ * The mappers are unlocked on return.
+ */
+static int
+swap_out_locked (struct memphy_struct *mram, struct memphy_struct *mswp,
+                 struct mm_struct *vicmm, int vicpgn, int vicfpn, int *retfpn)
+{
+  struct framephy_struct *fp;
+  struct memphy_struct *dev;
+  int swpfpn, swpnew;
+  int clsnum, nrnew, it, fpn, swpoff;
+  pte_t pte;
+  int swptype;
+
+  /* A shared frame leaves alone, its mappers are not contiguous */
+  if (mram->frmtbl[vicfpn].mapcount > 1)
+    {
+      if (swap_out_shared (mram, mswp, vicfpn) != 0)
+        return -1;
+      *retfpn = vicfpn;
+      return 0;
+    }
+
+  /* The idle resident pages following the victim go out along with it, in
+   * contiguous swap slots, so that a later sequential access faults them
+   * back in with a single readahead */
+  nrnew = (mram->frmtbl[vicfpn].swpoff < 0);
+  for (clsnum = 1; clsnum < PAGING_SWAP_CLUSTER; clsnum++)
+    {
+      if (vicpgn + clsnum >= PAGING_MAX_PGN)
+        break;
+
+      pte = pte_get (vicmm, vicpgn + clsnum);
+      if (!PAGING_PAGE_PRESENT (pte))
+        break;
+
+      fp = &mram->frmtbl[PAGING_PTE_FPN (pte)];
+      if (fp->owner != vicmm || __atomic_load_n (&fp->refbit, __ATOMIC_RELAXED)
+          || fp->mapcount != 1)
+        break;
+
+      nrnew += (fp->swpoff < 0);
+    }
+
+  /* Reserve free frames on one MEMSWP for the pages without a swap cache
+   * slot, the ones taken by the compressed pool are given back afterward */
+  swpfpn = -1;
+  swpnew = 0;
+  if (nrnew > 0 && swap_alloc (mswp, nrnew, &swpnew, &swpfpn) != 0)
+    { /* Swap space is fragmented, evict the victim alone */
+      clsnum = 1;
+      nrnew = (mram->frmtbl[vicfpn].swpoff < 0);
+      if (nrnew > 0 && swap_alloc (mswp, 1, &swpnew, &swpfpn) != 0)
+        nrnew = 0;
     }
 
+  for (it = 0; it < clsnum; it++)
+    {
+      pte = pte_get (vicmm, vicpgn + it);
+      fpn = PAGING_PTE_FPN (pte);
+      fp = &mram->frmtbl[fpn];
+      swptype = 0;
+
+      if (fp->swpoff >= 0)
+        { /* The swap cache slot is reused, written only if modified */
+          swptype = fp->swptyp;
+          swpoff = fp->swpoff;
+          dev = swap_dev (mswp, swptype);
+          if (pte & PAGING_PTE_DIRTY_MASK)
+            __swap_cp_page (mram, fpn, dev, swpoff);
+          swap_set_owner (dev, swpoff, vicmm, vicpgn + it,
+                          __atomic_load_n (&fp->heat, __ATOMIC_RELAXED));
+        }
+#ifdef MM_ZSWAP
+      else if (zswap_store (mram, fpn, mswp, vicmm, vicpgn + it, &swpoff)
+               == 0)
+        { /* Kept compressed in host memory, no device I/O */
+          swptype = PAGING_ZSWAP_SWPTYP;
+        }
+#endif
+      else if (nrnew > 0)
+        { /* First time out, copy victim frame to a new swap slot */
+          swptype = swpnew;
+          swpoff = swpfpn++;
+          nrnew--;
+          dev = swap_dev (mswp, swptype);
+          swap_set_owner (dev, swpoff, vicmm, vicpgn + it,
+                          __atomic_load_n (&fp->heat, __ATOMIC_RELAXED));
+          __swap_cp_page (mram, fpn, dev, swpoff);
+        }
+      else
+        { /* Only the victim itself can get here */
+          pthread_mutex_unlock (&vicmm->mm_lock);
+          return -1;
+        }
+
+      /* Update pte of victim to swap, through the owner in reverse map */
+      swap_unmap_pte (vicmm, vicpgn + it, swptype, swpoff);
+
+      /* A readahead page leaving untouched was a wasted read */
+      if (__atomic_load_n (&fp->rabit, __ATOMIC_RELAXED)
+          && vicmm->ra_win > PAGING_RA_MINWIN)
+        vicmm->ra_win /= 2;
+
+      /* The slot now belongs to the PTE */
+      fp->swpoff = -1;
+      MEMPHY_set_rmap (mram, fpn, NULL, -1);
+
+      /* The victim frame goes to the caller, the others are free now */
+      if (it > 0)
+        MEMPHY_put_freefp (mram, fpn);
+    }
+
+  /* Give back the reserved slots left unused */
+  while (nrnew-- > 0)
+    MEMPHY_put_freefp (swap_dev (mswp, swpnew), swpfpn++);
+
+  pthread_mutex_unlock (&vicmm->mm_lock);
+  *retfpn = vicfpn;
+
   return 0;
 }
 
+/*
+ * swap_out_page - evict the page picked by the global replacement policy
+ * @mram   : MEMRAM to take the frame from
+ * @mswp   : swap devices receiving the victim
+ * @memcg  : only evict a page of this group, NULL for any
+ * @retfpn : return the MEMRAM frame released by the eviction
+ *
+ * The victim may belong to any process, its owner and page number come
+ * from the reverse map of the MEMRAM frame table. Return 1 when all the
+ * candidates belong to processes holding their mm lock.
+ */
+int
+swap_out_page (struct memphy_struct *mram, struct memphy_struct *mswp,
+               struct memcg_struct *memcg, int *retfpn)
+{
+  struct mm_struct *vicmm;
+  int vicpgn, vicfpn;
+  int ret;
+
+  /* Find the victim page system-wide, its owner comes locked */
+  ret = find_victim_page (mram, memcg, &vicmm, &vicpgn, &vicfpn);
+  if (ret != 0)
+    {
+#ifdef MMDBG
+      if (ret < 0)
+        printf ("\tCannot find victim page\n");
+#endif
+      return ret;
+    }
+
+  return swap_out_locked (mram, mswp, vicmm, vicpgn, vicfpn, retfpn);
+}
+
+/*
+ * swap_out_mm - evict the private resident pages of a process
+ * @mram : MEMRAM
+ * @mswp : swap devices
+ * @mm   : mm of a process kept off the CPUs
+ *
+ * The pages are recorded as the working set of the mm, for swap_in_mm to
+ * bring back. Shared and huge pages stay. Return the number of resident
+ * pages released.
+ */
+int
+swap_out_mm (struct memphy_struct *mram, struct memphy_struct *mswp,
+             struct mm_struct *mm)
+{
+  struct framephy_struct *fp;
+  struct pgn_t *pg;
+  int pgn, fpn, rss, lopgn;
+  pte_t pte;
+
+  pthread_mutex_lock (&mm->mm_lock);
+  rss = mm->rss;
+  lopgn = mm->pgd_lo * PAGING_PTBL_LEAFSZ;
+
+  /* Listed in ascending order, each eviction takes the idle pages
+   * following the victim along in contiguous swap slots */
+  for (pgn = mm->pgd_hi * PAGING_PTBL_LEAFSZ - 1; pgn >= lopgn; pgn--)
+    {
+      if (mm->pgd[PAGING_PTBL_DIR (pgn)] == NULL)
+        { /* Skip a whole leaf never allocated */
+          pgn -= pgn % PAGING_PTBL_LEAFSZ;
+          continue;
+        }
+
+      pte = pte_get (mm, pgn);
+      if (!PAGING_PAGE_PRESENT (pte) || (pte & PAGING_PTE_HUGE_MASK))
+        continue;
+
+      fp = &mram->frmtbl[PAGING_PTE_FPN (pte)];
+      if (fp->owner == mm && fp->mapcount == 1)
+        enlist_pgn_node (&mm->ws_list, pgn);
+    }
+
+  for (pg = mm->ws_list; pg != NULL; pg = pg->pg_next)
+    {
+      pte = pte_get (mm, pg->pgn);
+      if (!PAGING_PAGE_PRESENT (pte))
+        continue; /* Went out along with an earlier one */
+
+      fpn = PAGING_PTE_FPN (pte);
+      if (frame_trylock_mappers (mram, fpn) != 0)
+        continue;
+
+      if (swap_out_locked (mram, mswp, mm, pg->pgn, fpn, &fpn) == 0)
+        MEMPHY_put_freefp (mram, fpn);
+    }
+
+  rss -= mm->rss;
+  pthread_mutex_unlock (&mm->mm_lock);
+
+  return rss;
+}
+
+/*
+ * put_free_frame - release a MEMRAM frame along with its swap cache slot
+ * @mram : MEMRAM owning the frame
+ * @mswp : swap devices
+ * @fpn  : frame number
+ */
+int
+put_free_frame (struct memphy_struct *mram, struct memphy_struct *mswp,
+                int fpn)
+{
+  struct framephy_struct *fp;
+
+  if (fpn < 0 || fpn >= mram->maxfpn)
+    return -1;
+
+  fp = &mram->frmtbl[fpn];
+  if (fp->swpoff >= 0)
+    swap_put_slot (swap_dev (mswp, fp->swptyp), fp->swpoff);
+
+  return MEMPHY_put_freefp (mram, fpn);
+}
+
+/*
+ * unmap_frame - drop one PTE mapping of a MEMRAM frame
+ * @mram : MEMRAM owning the frame
+ * @mswp : swap devices
+ * @fpn  : frame number
+ * @mm   : mm of the PTE
+ * @pgn  : page number of the PTE
+ *
+ * The frame is released along with its last mapper, the zero frame never.
+ */
+int
+unmap_frame (struct memphy_struct *mram, struct memphy_struct *mswp, int fpn,
+             struct mm_struct *mm, int pgn)
+{
+  mm_charge (mm, -1);
+
+  if (fpn == mram->zero_fpn)
+    return 0;
+
+  if (MEMPHY_del_rmap (mram, fpn, mm, pgn) > 0)
+    return 0;
+
+  return put_free_frame (mram, mswp, fpn);
+}
+
+/*
+ * unmap_huge - release the frames of a huge page
+ * @mram : MEMRAM owning the frames
+ * @mm   : mm mapping the huge page
+ * @fpn  : first frame
+ */
+int
+unmap_huge (struct memphy_struct *mram, struct mm_struct *mm, int fpn)
+{
+  int it;
+
+  for (it = 0; it < PAGING_HUGE_NR; it++)
+    MEMPHY_put_freefp (mram, fpn + it);
+  mm_charge (mm, -PAGING_HUGE_NR);
+
+  return 0;
+}
+
+/*
+ * put_swap_entry - release the swap space held by a swapped out PTE
+ * @mswp : swap devices
+ * @pte  : page table entry of a swapped page
+ */
+int
+put_swap_entry (struct memphy_struct *mswp, pte_t pte)
+{
+#ifdef MM_ZSWAP
+  if (PAGING_PTE_SWPTYP (pte) == PAGING_ZSWAP_SWPTYP)
+    return zswap_invalidate (PAGING_PTE_SWPOFF (pte));
+#endif
+
+  return swap_put_slot (swap_dev (mswp, PAGING_PTE_SWPTYP (pte)),
+                        PAGING_PTE_SWPOFF (pte));
+}
+
+/*
+ * numa_node - MEMRAM node a new frame of the caller comes from
+ * @caller : caller
+ *
+ * First touch places the page on the node of the CPU running the caller,
+ * interleave spreads the pages of a process over every node in turn.
+ */
+int
+numa_node (struct pcb_t *caller)
+{
+#if defined(MM_NUMA) && MM_NUMA_POLICY == NUMA_INTERLEAVE
+  return caller->mm->numa_next++ % caller->mram->nr_nodes;
+#elif defined(MM_NUMA)
+  return caller->node % caller->mram->nr_nodes;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * get_free_frame - get a MEMRAM frame, evict a victim page if RAM is full
+ * @caller : caller
+ * @retfpn : return frame number
+ *
+ * With the page-out daemon running the free list is rarely empty, direct
+ * eviction is only the fallback when the daemon falls behind. A full node
+ * lends a frame of the next one before anything is evicted.
+ *
+ * A group at its hard limit evicts one of its own pages instead, and goes
+ * over only when none of them can be. Groups over their soft limit are the
+ * first victims of a direct eviction.
+ */
+int
+get_free_frame (struct pcb_t *caller, int *retfpn)
+{
+  struct memcg_struct *memcg = NULL;
+  int node = numa_node (caller);
+  int ret;
+
+#ifdef MM_MEMCG
+  if (memcg_over (caller->mm->memcg, 1))
+    {
+      if (memcg_reclaim (caller->mram, caller->active_mswp, caller->mm->memcg,
+                         retfpn)
+          == 0)
+        return 0;
+
+      __atomic_fetch_add (&caller->mm->memcg->nr_overlimit, 1,
+                          __ATOMIC_RELAXED);
+    }
+#endif
+
+  if (MEMPHY_get_freefp_near (caller->mram, node, retfpn) == 0)
+    return 0;
+
+#ifdef MM_MEMCG
+  memcg = memcg_soft_excess ();
+#endif
+
+  /* Cannot find any frame from RAM, swap one from RAM to SWAP */
+  for (;;)
+    {
+      if (memcg != NULL)
+        {
+          if (memcg_reclaim (caller->mram, caller->active_mswp, memcg, retfpn)
+              == 0)
+            return 0;
+
+          /* Nothing of that group can go, anyone's page will do */
+          memcg = NULL;
+        }
+
+      ret = swap_out_page (caller->mram, caller->active_mswp, NULL, retfpn);
+      if (ret <= 0)
+        return ret;
+
+      /* Every victim belongs to a process in the middle of a memory access,
+       * which may itself be waiting for one of ours: let it go on. Our page
+       * table is consistent whenever a frame is asked for */
+      pthread_mutex_unlock (&caller->mm->mm_lock);
+      sched_yield ();
+      pthread_mutex_lock (&caller->mm->mm_lock);
+
+      if (MEMPHY_get_freefp_near (caller->mram, node, retfpn) == 0)
+        return 0;
+    }
+}
+
+/*
+ * kswapd_balance - page out ahead of demand to keep free frames available
+ * @mram : MEMRAM to watch
+ * @mswp : swap devices receiving the victims
+ *
+ * Nothing happens while the free frame count is above the low watermark,
+ * otherwise victims are evicted until the high watermark is reached, from
+ * the groups over their soft limit first. Return the number of frames
+ * reclaimed.
+ */
+int
+kswapd_balance (struct memphy_struct *mram, struct memphy_struct *mswp)
+{
+  int lowmark = PAGING_KSWAPD_MARK (mram, PAGING_KSWAPD_LOWMARK);
+  int highmark = PAGING_KSWAPD_MARK (mram, PAGING_KSWAPD_HIGHMARK);
+  struct memcg_struct *memcg = NULL;
+  int nr_reclaimed = 0;
+  int fpn;
+
+  if (mram->free_fpcnt >= lowmark)
+    return 0;
+
+  while (mram->free_fpcnt < highmark)
+    {
+#ifdef MM_MEMCG
+      memcg = memcg_soft_excess ();
+#endif
+      if (memcg != NULL && memcg_reclaim (mram, mswp, memcg, &fpn) == 0)
+        ; /* The group gave back some of its excess */
+      else if (swap_out_page (mram, mswp, NULL, &fpn) != 0)
+        break; /* Nothing left to evict */
+
+      MEMPHY_put_freefp (mram, fpn);
+      nr_reclaimed++;
+    }
+
+#ifdef MMDBG
+  if (nr_reclaimed > 0)
+    printf ("\t[KSWAPD] reclaimed %d frames, %d free\n", nr_reclaimed,
+            mram->free_fpcnt);
+#endif
+
+  return nr_reclaimed;
+}
+
+/*
+ * swap_move_slot - copy a swapped page from one device slot to another
+ * @src    : device holding the page
+ * @srcoff : its slot
+ * @dst    : destination device
+ * @dstoff : destination slot
+ */
+static void
+swap_move_slot (struct memphy_struct *src, int srcoff,
+                struct memphy_struct *dst, int dstoff)
+{
+  BYTE page[PAGING_MAX_PAGESZ];
+
+#ifdef MM_BLK
+  /* A write of the slot may still be queued */
+  blk_unplug (src);
+#endif
+  MEMPHY_read_frame (src, srcoff, page);
+  src->nr_rdpg++;
+  dst->nr_wrpg++;
+
+#ifdef MM_BLK
+  blk_submit_write (dst, dstoff, page);
+#else
+  MEMPHY_write_frame (dst, dstoff, page);
+#endif
+}
+
+/*
+ * frame_cool - let the access counts of resident pages fade
+ * @mram : MEMRAM
+ *
+ * Called every PAGING_HEAT_INTERVAL time slots, a page keeps a heat of
+ * about twice the accesses it gets in that time. A CPU runs one
+ * instruction per slot, so a page touched in every other slot is hot.
+ */
+void
+frame_cool (struct memphy_struct *mram)
+{
+  int fpn;
+
+  for (fpn = 0; fpn < mram->maxfpn; fpn++)
+    __atomic_store_n (
+        &mram->frmtbl[fpn].heat,
+        __atomic_load_n (&mram->frmtbl[fpn].heat, __ATOMIC_RELAXED) >> 1,
+        __ATOMIC_RELAXED);
+}
+
+int
+numa_dump (struct memphy_struct *mram)
+{
+  unsigned long nr = mram->nr_local + mram->nr_remote;
+  int node;
+
+  for (node = 0; node < mram->nr_nodes; node++)
+    printf ("NODE%d: %d frames free\n", node, mram->node_free[node]);
+  printf ("NUMA: %lu local and %lu remote accesses, %.2f average latency, "
+          "%lu pages migrated\n",
+          mram->nr_local, mram->nr_remote,
+          nr > 0 ? (double)(mram->nr_local * PAGING_NUMA_LOCAL_LAT
+                            + mram->nr_remote * mram->remote_lat)
+                       / nr
+                 : 0.0,
+          mram->nr_migrated);
+
+  return 0;
+}
+
+/*
+ * swap_migrate - move a swapped out page to a slot of another tier
+ * @mswp   : swap devices
+ * @typ    : device holding the page
+ * @off    : slot of the page, its device locked by the caller
+ * @mintyp : first device the page may go to
+ * @maxtyp : last device the page may go to
+ *
+ * The device lock is released. Return 0 when the page moved, 1 when it
+ * cannot move now and -1 when the target tiers are full.
+ */
+static int
+swap_migrate (struct memphy_struct *mswp, int typ, int off, int mintyp,
+              int maxtyp)
+{
+  struct memphy_struct *dev = &mswp[typ];
+  struct framephy_struct *slot = &dev->frmtbl[off];
+  struct mm_struct *owner = slot->owner;
+  int pgn = slot->pgn, heat = slot->heat;
+  int ntyp = -1, noff;
+  pte_t pte;
+
+  if (pthread_mutex_trylock (&owner->mm_lock) != 0)
+    {
+      MEMPHY_unlock (dev);
+      return 1;
+    }
+  MEMPHY_unlock (dev);
+
+  /* The slot may have become a swap cache copy meanwhile */
+  pte = pte_get (owner, pgn);
+  if (PAGING_PAGE_PRESENT (pte) || !PAGING_PAGE_SWAPPED (pte)
+      || PAGING_PTE_SWPTYP (pte) != typ || PAGING_PTE_SWPOFF (pte) != off)
+    {
+      pthread_mutex_unlock (&owner->mm_lock);
+      return 1;
+    }
+
+  if (swap_get_slots (mswp, mintyp, 1, &ntyp, &noff) != 0 || ntyp > maxtyp)
+    {
+      if (ntyp > maxtyp)
+        MEMPHY_put_freefp (&mswp[ntyp], noff);
+      pthread_mutex_unlock (&owner->mm_lock);
+      return -1;
+    }
+
+  swap_move_slot (dev, off, &mswp[ntyp], noff);
+  swap_set_owner (&mswp[ntyp], noff, owner, pgn, heat);
+  pte_set_swap (pte_ptr (owner, pgn), ntyp, noff);
+  pthread_mutex_unlock (&owner->mm_lock);
+
+  swap_put_slot (dev, off);
+
+  return 0;
+}
+
+/*
+ * swap_tier_used - a tier holds more than the demotion mark
+ * @dev  : swap device
+ * @more : slots about to be taken
+ */
+static int
+swap_tier_used (struct memphy_struct *dev, int more)
+{
+  return (dev->maxfpn - dev->free_fpcnt + more) * 100
+         > dev->maxfpn * PAGING_SWAP_DEMOTE_MARK;
+}
+
+/*
+ * swap_demote - move cold pages of a filling tier to the slower devices
+ * @mswp : swap devices, the lower numbered the faster
+ *
+ * The clock hand of a device above PAGING_SWAP_DEMOTE_MARK percent of
+ * slots in use sweeps them, halving the heat of the pages it passes. A
+ * page swapped out by a single owner and found cold goes to a following
+ * device. Return the number of pages moved.
+ */
+int
+swap_demote (struct memphy_struct *mswp)
+{
+  struct memphy_struct *dev;
+  struct framephy_struct *slot;
+  int typ, off, scan, ret, nr_moved = 0;
+
+  for (typ = 0; typ + 1 < PAGING_MAX_MMSWP; typ++)
+    {
+      dev = &mswp[typ];
+
+      for (scan = 0; scan < dev->maxfpn && nr_moved < PAGING_SWAP_CLUSTER;
+           scan++)
+        {
+          if (!swap_tier_used (dev, 0))
+            break;
+
+          MEMPHY_lock (dev);
+          off = dev->clock_hand;
+          dev->clock_hand = (off + 1) % dev->maxfpn;
+          slot = &dev->frmtbl[off];
+
+          if (slot->isfree || slot->mapcount != 1 || slot->owner == NULL)
+            {
+              MEMPHY_unlock (dev);
+              continue;
+            }
+
+          if (slot->heat > 0)
+            { /* Still warm, it has to cool down first */
+              slot->heat >>= 1;
+              MEMPHY_unlock (dev);
+              continue;
+            }
+
+          ret = swap_migrate (mswp, typ, off, typ + 1, PAGING_MAX_MMSWP - 1);
+          if (ret < 0) /* The slower tiers are full as well */
+            break;
+          if (ret == 0)
+            nr_moved++;
+        }
+    }
+
+#ifdef MMDBG
+  if (nr_moved > 0)
+    printf ("\t[SWAP] demoted %d pages to slower devices\n", nr_moved);
+#endif
+
+  return nr_moved;
+}
+
+/*
+ * swap_promote - move hot pages of the slower tiers one tier up
+ * @mswp : swap devices, the lower numbered the faster
+ *
+ * A page swapped out hot to a slower device, the faster ones being full
+ * at the time, goes up once the tier above has room below the demotion
+ * mark. Its heat has to fade before it is demoted again. Return the
+ * number of pages moved.
+ */
+int
+swap_promote (struct memphy_struct *mswp)
+{
+  struct memphy_struct *dev;
+  struct framephy_struct *slot;
+  int typ, off, scan, ret, nr_moved = 0;
+
+  for (typ = 1; typ < PAGING_MAX_MMSWP; typ++)
+    {
+      dev = &mswp[typ];
+      if (dev->free_fpcnt == dev->maxfpn)
+        continue;
+
+      for (scan = 0; scan < dev->maxfpn && nr_moved < PAGING_SWAP_CLUSTER;
+           scan++)
+        {
+          if (swap_tier_used (&mswp[typ - 1], 1))
+            break;
+
+          MEMPHY_lock (dev);
+          off = (dev->clock_hand + scan) % dev->maxfpn;
+          slot = &dev->frmtbl[off];
+
+          if (slot->isfree || slot->mapcount != 1 || slot->owner == NULL
+              || slot->heat < PAGING_HEAT_HOT)
+            {
+              MEMPHY_unlock (dev);
+              continue;
+            }
+
+          ret = swap_migrate (mswp, typ, off, typ - 1, typ - 1);
+          if (ret < 0)
+            break;
+          if (ret == 0)
+            nr_moved++;
+        }
+    }
+
+#ifdef MMDBG
+  if (nr_moved > 0)
+    printf ("\t[SWAP] promoted %d pages to faster devices\n", nr_moved);
+#endif
+
+  return nr_moved;
+}
+
 /*
  * alloc_pages_range - allocate req_pgnum of frame in ram
  * @caller    : caller
@@ -153,75 +1197,31 @@ alloc_pages_range (struct pcb_t *caller, int req_pgnum,
   struct mm_struct *owner_mm = caller->mm;
 
   /* Perform allocating procedure for each page iterable
-   * If we cannot find the free frame,
-   * find it in swap and swap it with
-   * an victim page found on the global
-   * FIFO
+   * If we cannot find the free frame, a victim page found by the global
+   * replacement policy is swapped out to make room
    * */
   for (pgit = 0; pgit < req_pgnum; pgit++)
     {
-      if (MEMPHY_get_freefp (caller->mram, &fpn) != 0)
-        { /* Cannot find any frame from RAM, swap one from RAM to SWAP */
-          struct memphy_struct *swpsrc = NULL;
-          int vicpgn, swpfpn;
-          int vicfpn;
-          uint32_t vicpte;
-          int swptype
-              = 0; /* We only have one swap devices which is the first one */
-
-          /* Find and pop victim page out */
-
-          if (find_victim_page (caller->mm, &vicpgn) != 0)
-            {
-#ifdef MMDBG
-              printf ("\tCannot find victim page\n");
-#endif
-              return -1; /* Invalid page access */
-            }
-
-          vicpte = caller->mm->pgd[vicpgn]; /* Get victim's page entry */
-
-          vicfpn
-              = GETVAL (vicpte, PAGING_PTE_FPN_MASK,
-                        PAGING_PTE_FPN_LOBIT); /* Get victim's frame number */
-
-          /* Get free frame in MEMSWP */
-          if (MEMPHY_get_freefp (caller->active_mswp, &swpfpn) != 0)
+      if (get_free_frame (caller, &fpn) != 0)
+        { /* No frame left to evict, give back what we have taken */
+          while (newfp_head != NULL)
             {
-              return -1;
+              tmp = newfp_head;
+              newfp_head = newfp_head->fp_next;
+              MEMPHY_put_freefp (caller->mram, tmp->fpn);
+              free (tmp);
             }
-          else
-            swpsrc = caller->active_mswp;
-
-          /* Copy victim frame to swap */
-          __swap_cp_page (caller->mram, vicfpn, swpsrc, swpfpn);
-
-          /* Update pte of victim to swap */
-          pte_set_swap (&caller->mm->pgd[vicpgn], swptype, vicfpn);
-
-          /* We don't need to seap the fpn to vicfpn because we
-           * are allocating, not reading from the frame */
-          fpn = vicfpn;
+          return -3000;
         }
 
       /* Add new frame to the new frame list */
-      if (newfp_head != NULL)
-        { /* New frame list is not empty */
-          tmp = malloc (sizeof (struct framephy_struct));
-          tmp->fp_next = newfp_head;
-          tmp->fpn = fpn;
-          tmp->owner = owner_mm;
-
-          newfp_head = tmp;
-          tmp = NULL;
-        }
-      else
-        { /* New frame list is empty, initialize it */
-          newfp_head = malloc (sizeof (struct framephy_struct));
-          newfp_head->fpn = fpn;
-          newfp_head->owner = owner_mm; /* Adding for precaution */
-          newfp_head->fp_next = NULL;
-        }
+      tmp = malloc (sizeof (struct framephy_struct));
+      tmp->fp_next = newfp_head;
+      tmp->fpn = fpn;
+      tmp->owner = owner_mm;
+
+      newfp_head = tmp;
+      tmp = NULL;
     }
 
   /* Set the frame list */
@@ -236,6 +1236,54 @@ alloc_pages_range (struct pcb_t *caller, int req_pgnum,
   return 0;
 }
 
+/*
+ * vm_populate_rg - back every unmapped page of a region with a frame
+ * @caller    : caller
+ * @rg_start  : region start
+ * @rg_end    : region end
+ *
+ * Regions reused from the free list may lie on pages released by __free.
+ */
+int
+vm_populate_rg (struct pcb_t *caller, int rg_start, int rg_end)
+{
+  int pgn, fpn;
+  pte_t *pte;
+
+  if (rg_start >= rg_end)
+    return 0;
+
+  for (pgn = PAGING_PGN (rg_start); pgn <= PAGING_PGN (rg_end - 1); pgn++)
+    {
+      pte = pte_ptr (caller->mm, pgn);
+
+      if (PAGING_PAGE_PRESENT (*pte) || PAGING_PAGE_SWAPPED (*pte))
+        continue;
+
+#ifdef MM_KSM
+      if (caller->mram->zero_fpn >= 0)
+        { /* Backed by the zero frame until written */
+          init_pte (pte, /* present: */ 1, /* fpn: */ caller->mram->zero_fpn,
+                    /* drt: */ 0, /* swp: */ 0, /* swptyp */ 0,
+                    /*  swpoff */ 0);
+          SETBIT (*pte, PAGING_PTE_COW_MASK);
+          mm_charge (caller->mm, 1);
+          continue;
+        }
+#endif
+
+      if (get_free_frame (caller, &fpn) != 0)
+        return -1;
+
+      init_pte (pte, /* present: */ 1, /* fpn: */ fpn, /* drt: */ 0,
+                /* swp: */ 0, /* swptyp */ 0, /*  swpoff */ 0);
+      MEMPHY_set_rmap (caller->mram, fpn, caller->mm, pgn);
+      mm_charge (caller->mm, 1);
+    }
+
+  return 0;
+}
+
 /*
  * vm_map_ram - do the mapping all vm are to ram storage device
  * @caller    : caller
@@ -244,7 +1292,7 @@ alloc_pages_range (struct pcb_t *caller, int req_pgnum,
  * @ret_rg    : returned region
  */
 int
-vm_map_ram (struct pcb_t *caller, int mapstart, int incpgnum,
+vm_map_ram (struct pcb_t *caller, addr_t mapstart, int incpgnum,
             struct vm_rg_struct *ret_rg)
 {
   struct framephy_struct *frm_lst = NULL;
@@ -257,6 +1305,27 @@ vm_map_ram (struct pcb_t *caller, int mapstart, int incpgnum,
    *in endless procedure of swap-off to get frame and we have not provide
    *duplicate control mechanism, keep it simple
    */
+#ifdef MM_DEMAND
+  /* Only reserve the range, pg_getpage maps each page on its first touch */
+  if (PAGING_PGN (mapstart) + incpgnum > PAGING_MAX_PGN)
+    return -1;
+
+  ret_rg->rg_start = mapstart;
+  ret_rg->rg_end = mapstart + incpgnum * PAGING_PAGESZ;
+
+  return 0;
+#endif
+
+#ifdef MM_KSM
+  if (caller->mram->zero_fpn >= 0)
+    { /* Fresh pages all start on the zero frame, a private frame is only
+       * taken by the first write to each of them */
+      if (vmap_page_range (caller, mapstart, incpgnum, NULL, ret_rg) == -2)
+        return -1;
+      return 0;
+    }
+#endif
+
   ret_alloc = alloc_pages_range (caller, incpgnum, &frm_lst);
 
   /* Frame list are empty */
@@ -277,6 +1346,14 @@ vm_map_ram (struct pcb_t *caller, int mapstart, int incpgnum,
   int map_page_range
       = vmap_page_range (caller, mapstart, incpgnum, frm_lst, ret_rg);
 
+  /* The frames now live in the frame table, drop the transient list */
+  while (frm_lst != NULL)
+    {
+      struct framephy_struct *fp = frm_lst;
+      frm_lst = frm_lst->fp_next;
+      free (fp);
+    }
+
   if (map_page_range == -2)
     {
 #ifdef MMDBG
@@ -298,18 +1375,114 @@ int
 __swap_cp_page (struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn)
 {
-  int cellidx;
-  int addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
+  BYTE page[PAGING_MAX_PAGESZ];
+
+  mpsrc->nr_rdpg++;
+  mpdst->nr_wrpg++;
+
+#ifdef MM_BLK
+  /* Swap devices are reached through their request queue */
+  if (mpsrc->bq != NULL)
+    return blk_read (mpsrc, srcfpn, mpdst, dstfpn);
+#endif
+
+  if (MEMPHY_read_frame (mpsrc, srcfpn, page) != 0)
+    return -1;
+
+#ifdef MM_BLK
+  if (mpdst->bq != NULL)
+    return blk_submit_write (mpdst, dstfpn, page);
+#endif
+
+  return MEMPHY_write_frame (mpdst, dstfpn, page);
+}
+
+/*
+ * mm_lock_init - set up the lock and the PTE sequence count of an mm
+ * @mm : self mm
+ */
+static void
+mm_lock_init (struct mm_struct *mm)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&mm->mm_lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+
+  mm->mm_seq = 0;
+}
+
+/*
+ * mm_charge - account resident pages to an mm, its group is charged with
+ *             the frames it owns instead, see MEMPHY_set_owner
+ * @mm : mm mapping or unmapping them, locked
+ * @nr : number of pages, negative when unmapped
+ */
+void
+mm_charge (struct mm_struct *mm, int nr)
+{
+  mm->rss += nr;
+}
+
+/*
+ * mm_release - free an mm whose pages have all been unmapped
+ * @mm   : mm of an exiting process, see free_pcb_memph
+ * @mswp : swap devices
+ *
+ * A swap cache slot may still name the mm as owner after its frame went to
+ * another mapper, it is disowned first. Nothing can reach the mm after that
+ * but a reclaimer that locked it earlier, waited for through its lock.
+ */
+int
+mm_release (struct mm_struct *mm, struct memphy_struct *mswp)
+{
+  struct vm_area_struct *vma;
+  struct memphy_struct *dev;
+  struct pgn_t *pg;
+  int typ, off, dir;
+
+  for (typ = 0; typ < PAGING_MAX_MMSWP; typ++)
+    {
+      dev = swap_dev (mswp, typ);
+      MEMPHY_lock (dev);
+      for (off = 0; off < dev->maxfpn; off++)
+        if (dev->frmtbl[off].owner == mm)
+          dev->frmtbl[off].owner = NULL;
+      MEMPHY_unlock (dev);
+    }
+#ifdef MM_ZSWAP
+  zswap_release (mm);
+#endif
+
+  pthread_mutex_lock (&mm->mm_lock);
+  pthread_mutex_unlock (&mm->mm_lock);
+  pthread_mutex_destroy (&mm->mm_lock);
+
+  while ((vma = mm->mmap) != NULL)
     {
-      addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-      addrdst = dstfpn * PAGING_PAGESZ + cellidx;
+      mm->mmap = vma->vm_next;
+      freerg_release (&vma->vm_freerg);
+      free (vma);
+    }
+  slab_release (mm);
+
+  if (mm->pgd != NULL)
+    {
+      for (dir = mm->pgd_lo; dir < mm->pgd_hi; dir++)
+        free (mm->pgd[dir]);
+      free (mm->pgd);
+    }
 
-      BYTE data;
-      MEMPHY_read (mpsrc, addrsrc, &data);
-      MEMPHY_write (mpdst, addrdst, data);
+  while ((pg = mm->ws_list) != NULL)
+    {
+      mm->ws_list = pg->pg_next;
+      free (pg);
     }
 
+  free (mm);
+
   return 0;
 }
 
@@ -322,25 +1495,230 @@ int
 init_mm (struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct *vma = malloc (sizeof (struct vm_area_struct));
+  int cls;
 
-  mm->pgd = malloc (PAGING_MAX_PGN * sizeof (uint32_t));
+  mm_lock_init (mm);
+
+  /* Leaves of the page table come with the first page mapped in them */
+  mm->pgd = NULL;
+  mm->pgd_nr = 0;
+  mm->pgd_lo = PAGING_PTBL_DIRSZ;
+  mm->pgd_hi = 0;
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 1;
   vma->vm_start = 0;
   vma->vm_end = vma->vm_start;
   vma->sbrk = vma->vm_start;
-  struct vm_rg_struct *first_rg = init_vm_rg (vma->vm_start, vma->vm_end);
-  enlist_vm_rg_node (&vma->vm_freerg_list, first_rg);
+  freerg_init (&vma->vm_freerg);
 
   vma->vm_next = NULL;
   vma->vm_mm = mm; /*point back to vma owner */
 
   mm->mmap = vma;
+  mm->ra_win = PAGING_RA_INITWIN;
+  mm->rss = 0;
+  mm->memcg = NULL;
+  mm->ws_list = NULL;
+  mm->numa_next = 0;
+
+  for (cls = 0; cls < PAGING_SLAB_NCLASS; cls++)
+    mm->slabs[cls] = NULL;
 
   return 0;
 }
 
+/*
+ *copy_mm_undo - take back what a failed copy_mm gave the child
+ * @newmm:  partial copy, its areas are left to mm_release
+ * @mm:     mm copied, locked
+ * @caller: owner of mm
+ *
+ * The mappers and slot users added for the child go away. A page left with
+ * its parent as only user is no longer copy-on-write, a slot gets its
+ * owner back so that it may be demoted again.
+ */
+static void
+copy_mm_undo (struct mm_struct *newmm, struct mm_struct *mm,
+              struct pcb_t *caller)
+{
+  struct memphy_struct *mram = caller->mram;
+  struct memphy_struct *mswp = caller->active_mswp, *dev;
+  int pgn, fpn, swpoff;
+  pte_t pte;
+
+  for (pgn = newmm->pgd_lo * PAGING_PTBL_LEAFSZ;
+       pgn < newmm->pgd_hi * PAGING_PTBL_LEAFSZ; pgn++)
+    {
+      if (newmm->pgd[PAGING_PTBL_DIR (pgn)] == NULL)
+        {
+          pgn += PAGING_PTBL_LEAFSZ - 1;
+          continue;
+        }
+
+      pte = pte_get (newmm, pgn);
+      if (pte & PAGING_PTE_HUGE_MASK)
+        unmap_huge (mram, newmm, PAGING_PTE_FPN (pte));
+      else if (PAGING_PAGE_PRESENT (pte))
+        {
+          fpn = PAGING_PTE_FPN (pte);
+          unmap_frame (mram, mswp, fpn, newmm, pgn);
+
+          MEMPHY_lock (mram);
+          if (fpn != mram->zero_fpn && mram->frmtbl[fpn].mapcount == 1
+              && mram->frmtbl[fpn].owner == mm)
+            CLRBIT (*pte_ptr (mm, pgn), PAGING_PTE_COW_MASK);
+          MEMPHY_unlock (mram);
+        }
+      else if (PAGING_PAGE_SWAPPED (pte))
+        {
+          dev = swap_dev (mswp, PAGING_PTE_SWPTYP (pte));
+          swpoff = PAGING_PTE_SWPOFF (pte);
+
+          MEMPHY_lock (dev);
+          swap_put_slot (dev, swpoff);
+          if (dev->frmtbl[swpoff].mapcount == 1)
+            {
+              dev->frmtbl[swpoff].owner = mm;
+              dev->frmtbl[swpoff].pgn = pgn;
+            }
+          MEMPHY_unlock (dev);
+        }
+
+      *pte_ptr (newmm, pgn) = 0;
+    }
+
+  /* Pages never reached by the copy */
+  mm_charge (newmm, -newmm->rss);
+}
+
+/*
+ *copy_mm - duplicate an address space, sharing every page copy-on-write
+ * @newmm:  mm to set up
+ * @mm:     mm copied
+ * @caller: owner of mm
+ *
+ * Only the page table is walked, no page content is copied: resident
+ * frames get one more mapper and swapped pages one more user of their slot.
+ * On failure the child maps nothing, the caller frees it with mm_release.
+ */
+int
+copy_mm (struct mm_struct *newmm, struct mm_struct *mm, struct pcb_t *caller)
+{
+  struct vm_area_struct *vma, **newvma;
+  struct memphy_struct *mram = caller->mram;
+  struct memphy_struct *mswp = caller->active_mswp, *dev;
+  pte_t pte;
+  int pgn, fpn, swptyp, swpoff, it;
+  int ret = 0;
+
+  *newmm = *mm;
+
+  /* The child maps every page of its parent, in the same group */
+  newmm->rss = 0;
+  mm_charge (newmm, mm->rss);
+  newmm->ws_list = NULL;
+
+  /* Reclaim may find the child among the mappers before it is complete */
+  mm_lock_init (newmm);
+  pthread_mutex_lock (&newmm->mm_lock);
+
+  newmm->pgd = NULL;
+  newmm->pgd_nr = 0;
+  newmm->pgd_lo = PAGING_PTBL_DIRSZ;
+  newmm->pgd_hi = 0;
+
+  /* Areas and their free regions are private copies */
+  newvma = &newmm->mmap;
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+    {
+      *newvma = malloc (sizeof (struct vm_area_struct));
+      **newvma = *vma;
+      (*newvma)->vm_mm = newmm;
+      freerg_copy (&(*newvma)->vm_freerg, &vma->vm_freerg);
+
+      newvma = &(*newvma)->vm_next;
+    }
+  slab_copy (newmm, mm);
+
+  for (pgn = mm->pgd_lo * PAGING_PTBL_LEAFSZ;
+       pgn < mm->pgd_hi * PAGING_PTBL_LEAFSZ; pgn++)
+    {
+      if (mm->pgd[PAGING_PTBL_DIR (pgn)] == NULL)
+        { /* Skip a whole leaf never allocated */
+          pgn += PAGING_PTBL_LEAFSZ - 1;
+          continue;
+        }
+
+      pte = pte_get (mm, pgn);
+      if (pte == 0)
+        continue;
+
+      if (pte & PAGING_PTE_HUGE_MASK)
+        { /* Huge pages are never shared, the child gets its own copy */
+          if (MEMPHY_get_freefp_range (mram, PAGING_HUGE_NR, &fpn) != 0)
+            {
+              ret = -1;
+              break;
+            }
+
+          for (it = 0; it < PAGING_HUGE_NR; it++)
+            __swap_cp_page (mram, PAGING_PTE_FPN (pte) + it, mram, fpn + it);
+
+          pte_set_fpn (pte_ptr (newmm, pgn), fpn);
+          SETBIT (*pte_ptr (newmm, pgn), PAGING_PTE_HUGE_MASK);
+          continue;
+        }
+
+      if (PAGING_PAGE_PRESENT (pte))
+        {
+          fpn = PAGING_PTE_FPN (pte);
+          if (fpn != mram->zero_fpn)
+            {
+              SETBIT (*pte_ptr (mm, pgn), PAGING_PTE_COW_MASK);
+              MEMPHY_add_rmap (mram, fpn, newmm, pgn);
+            }
+        }
+      else if (PAGING_PAGE_SWAPPED (pte))
+        {
+#ifdef MM_ZSWAP
+          /* A compressed entry has a single owner, move it to the device */
+          if (PAGING_PTE_SWPTYP (pte) == PAGING_ZSWAP_SWPTYP)
+            {
+              if (zswap_evict (PAGING_PTE_SWPOFF (pte), mswp, &swptyp,
+                               &swpoff)
+                  != 0)
+                {
+                  ret = -1;
+                  break;
+                }
+            }
+          else
+#endif
+            {
+              swptyp = PAGING_PTE_SWPTYP (pte);
+              swpoff = PAGING_PTE_SWPOFF (pte);
+            }
+
+          /* Shared from now on, the slot is no longer demoted */
+          dev = swap_dev (mswp, swptyp);
+          MEMPHY_lock (dev);
+          dev->frmtbl[swpoff].owner = NULL;
+          dev->frmtbl[swpoff].mapcount++;
+          MEMPHY_unlock (dev);
+        }
+
+      *pte_ptr (newmm, pgn) = pte_get (mm, pgn);
+    }
+
+  if (ret != 0)
+    copy_mm_undo (newmm, mm, caller);
+
+  pthread_mutex_unlock (&newmm->mm_lock);
+
+  return ret;
+}
+
 struct vm_rg_struct *
 init_vm_rg (int rg_start, int rg_end)
 {
@@ -457,7 +1835,7 @@ print_list_pgn (struct pgn_t *ip)
 }
 
 int
-print_pgtbl (struct pcb_t *caller, uint32_t start, uint32_t end)
+print_pgtbl (struct pcb_t *caller, addr_t start, addr_t end)
 {
   int pgn_start, pgn_end;
   int pgit;
@@ -471,7 +1849,7 @@ print_pgtbl (struct pcb_t *caller, uint32_t start, uint32_t end)
   pgn_start = PAGING_PGN (start);
   pgn_end = PAGING_PGN (end);
 
-  printf ("print_pgtbl: %d - %d", start, end);
+  printf ("print_pgtbl: %lu - %lu", start, end);
   if (caller == NULL)
     {
       printf ("NULL caller\n");
@@ -481,8 +1859,8 @@ print_pgtbl (struct pcb_t *caller, uint32_t start, uint32_t end)
 
   for (pgit = pgn_start; pgit < pgn_end; pgit++)
     {
-      printf ("%08ld: %08x\n", pgit * sizeof (uint32_t),
-              caller->mm->pgd[pgit]);
+      printf ("%08ld: %016llx\n", pgit * sizeof (pte_t),
+              pte_get (caller->mm, pgit));
     }
 
   return 0;
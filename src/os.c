@@ -15,10 +15,11 @@ static int num_cpus;
 static int done = 0;
 
 #ifdef MM_PAGING
-static int memramsz;
-static int memswpsz[PAGING_MAX_MMSWP];
-
-pthread_mutex_t mlock; /* Global lock for physical memory */
+static addr_t memramsz;
+static addr_t memswpsz[PAGING_MAX_MMSWP];
+static int numa_nodes = 1;
+static int numa_remote_lat = PAGING_NUMA_REMOTE_LAT;
+static int *cpu_node; /* NUMA node of every CPU */
 
 struct mmpaging_ld_args
 {
@@ -28,6 +29,27 @@ struct mmpaging_ld_args
   struct memphy_struct *active_mswp;
   struct timer_id_t *timer_id;
 };
+
+#ifdef SCHED_LOAD_CONTROL
+static int lc_stop = 0;
+
+struct lc_args
+{
+  struct memphy_struct *mram;
+  struct timer_id_t *timer_id;
+};
+#endif
+
+#ifdef MM_KSWAPD
+static int kswapd_stop = 0;
+
+struct kswapd_args
+{
+  struct memphy_struct *mram;
+  struct memphy_struct *mswp;
+  struct timer_id_t *timer_id;
+};
+#endif
 #endif
 
 static struct ld_args
@@ -37,6 +59,9 @@ static struct ld_args
 #ifdef MLQ_SCHED
   unsigned long *prio;
 #endif
+#ifdef MM_MEMCG
+  int *memcg;
+#endif
 } ld_processes;
 int num_processes;
 
@@ -46,6 +71,19 @@ struct cpu_args
   int id;
 };
 
+/*
+ * proc_stalled - the process still waits on a swap device seek
+ */
+static int
+proc_stalled (struct pcb_t *proc)
+{
+#ifdef MM_SEQ_SWAP
+  return proc->stall > 0;
+#else
+  return 0;
+#endif
+}
+
 static void *
 cpu_routine (void *args)
 {
@@ -63,10 +101,17 @@ cpu_routine (void *args)
            * ready queue */
           proc = get_proc ();
         }
-      else if (proc->pc == proc->code->size)
+      else if (proc->pc == proc->code->size && !proc_stalled (proc))
         {
           /* The process has finish it job */
           printf ("\tCPU %d: Processed %2d has finished\n", id, proc->pid);
+#ifdef MM_PAGING
+          /* Give frames back so that others stop evicting on its behalf */
+          pthread_mutex_lock (&proc->mm->mm_lock);
+          free_pcb_memph (proc);
+          pthread_mutex_unlock (&proc->mm->mm_lock);
+          mm_release (proc->mm, proc->active_mswp);
+#endif
           free (proc);
           proc = get_proc ();
           time_left = 0;
@@ -101,10 +146,23 @@ cpu_routine (void *args)
            * the queue or the process is the first one*/
           printf ("\tCPU %d: Dispatched process %2d\n", id, proc->pid);
           time_left = time_slot;
+#ifdef MM_NUMA
+          proc->node = cpu_node[id];
+#endif
         }
 
       /* Run current process */
+#ifdef MM_SEQ_SWAP
+      if (proc_stalled (proc))
+        proc->stall--; /* Still waiting for the swap device head */
+      else
+        {
+          run (proc);
+          proc->stall = MEMPHY_take_stall ();
+        }
+#else
       run (proc);
+#endif
       time_left--;
 #ifdef MLQ_SCHED
       decrease_q_time_left (); /* Decrease time left of each queue */
@@ -115,6 +173,66 @@ cpu_routine (void *args)
   pthread_exit (NULL);
 }
 
+#ifdef MM_KSWAPD
+static void *
+kswapd_routine (void *args)
+{
+  struct memphy_struct *mram = ((struct kswapd_args *)args)->mram;
+  struct memphy_struct *mswp = ((struct kswapd_args *)args)->mswp;
+  struct timer_id_t *timer_id = ((struct kswapd_args *)args)->timer_id;
+  int slot = 0;
+#ifdef MM_BLK
+  int sit;
+#endif
+
+  /* Act as a device of the timer, keep the free frames above the
+   * watermark once per time slot until every CPU has stopped */
+  while (!kswapd_stop)
+    {
+#ifdef MM_KSM
+      /* Merging identical pages is slower, run it every few slots */
+      if (slot % PAGING_KSM_INTERVAL == 0)
+        ksm_scan (mram, mswp);
+#endif
+      kswapd_balance (mram, mswp);
+      if (slot % PAGING_HEAT_INTERVAL == 0)
+        frame_cool (mram);
+#if MM_SWAP_POLICY == SWAP_TIER
+      swap_demote (mswp);
+      swap_promote (mswp);
+#endif
+#ifdef MM_BLK
+      /* Queued page-outs reach the devices at least once per slot */
+      for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+        blk_unplug (&mswp[sit]);
+#endif
+      slot++;
+      next_slot (timer_id);
+    }
+  detach_event (timer_id);
+  pthread_exit (NULL);
+}
+#endif
+
+#ifdef SCHED_LOAD_CONTROL
+static void *
+lc_routine (void *args)
+{
+  struct memphy_struct *mram = ((struct lc_args *)args)->mram;
+  struct timer_id_t *timer_id = ((struct lc_args *)args)->timer_id;
+
+  /* The medium-term scheduler, once per time slot until every CPU has
+   * stopped */
+  while (!lc_stop)
+    {
+      load_control (mram, num_cpus);
+      next_slot (timer_id);
+    }
+  detach_event (timer_id);
+  pthread_exit (NULL);
+}
+#endif
+
 static void *
 ld_routine (void *args)
 {
@@ -146,7 +264,11 @@ ld_routine (void *args)
       proc->mram = mram;
       proc->mswp = mswp;
       proc->active_mswp = active_mswp;
-      proc->mlock = (pthread_mutex_t *)&mlock;
+      proc->node = 0;
+      proc->stall = 0;
+#endif
+#ifdef MM_MEMCG
+      proc->mm->memcg = memcg_get (ld_processes.memcg[i]);
 #endif
       printf ("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
               ld_processes.path[i], proc->pid, ld_processes.prio[i]);
@@ -157,6 +279,9 @@ ld_routine (void *args)
     }
   free (ld_processes.path);
   free (ld_processes.start_time);
+#ifdef MM_MEMCG
+  free (ld_processes.memcg);
+#endif
   done = 1;
   detach_event (timer_id);
   pthread_exit (NULL);
@@ -177,6 +302,10 @@ read_config (const char *path)
       = (unsigned long *)malloc (sizeof (unsigned long) * num_processes);
 #ifdef MM_PAGING
   int sit;
+  char memline[256] = "";
+  int legacy = 1; /* no memory line, memline holds the first process */
+
+  cpu_node = (int *)malloc (sizeof (int) * num_cpus);
 #ifdef MM_FIXED_MEMSZ
   /* We provide here a back compatible with legacy OS simulatiom config file
    * In which, it have no addition config line for Mema, keep only one line
@@ -187,22 +316,101 @@ read_config (const char *path)
   memswpsz[0] = 0x1000000;
   for (sit = 1; sit < PAGING_MAX_MMSWP; sit++)
     memswpsz[sit] = 0;
+  for (sit = 0; sit < num_cpus; sit++)
+    cpu_node[sit] = 0;
 #else
   /* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
    * Format: (size=0 result non-used memswap, must have RAM and at least 1
    * SWAP) MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
+   * optionally followed by [PAGE_SZ] [HUGE_ORDER], a page size power of two
+   * and the log2 of the number of pages in a huge page (0 = none), by
+   * [NUMA_NODES] [NUMA_REMOTE_LAT], the number of equal parts of MEMRAM and
+   * the latency of an access to another node than the one of the CPU, and
+   * by [CPU0_NODE CPU1_NODE ...] the node of every CPU. By default the CPUs
+   * are split in runs of the same size, one run per node. A config without
+   * memory line gets the legacy sizes, see MM_FIXED_MEMSZ
    */
-  fscanf (file, "%d\n", &memramsz);
+  int pagesz = PAGING_DEFAULT_PAGESZ, huge_order = 0;
+  int off = 0, len, nrcpu = 0;
+
+  memramsz = 0;
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    memswpsz[sit] = 0;
+
+  if (fgets (memline, sizeof (memline), file) != NULL
+      && sscanf (memline, "%lu %lu %lu %lu %lu %d %d %d %d%n", &memramsz,
+                 &memswpsz[0], &memswpsz[1], &memswpsz[2], &memswpsz[3],
+                 &pagesz, &huge_order, &numa_nodes, &numa_remote_lat, &off)
+             >= 2)
+    legacy = 0;
+  else
+    {
+      memramsz = 0x100000;
+      memswpsz[0] = 0x1000000;
+    }
+
+  while (off > 0 && nrcpu < num_cpus
+         && sscanf (memline + off, "%d%n", &cpu_node[nrcpu], &len) == 1)
+    {
+      off += len;
+      nrcpu++;
+    }
+
+  if (paging_setup (pagesz, huge_order) != 0)
+    {
+      printf ("Invalid page size %d or huge page order %d\n", pagesz,
+              huge_order);
+      exit (1);
+    }
+
+  /* Frame and swap slot numbers have to fit */
+  if (memramsz / pagesz > PAGING_MAX_NRFRAME)
+    {
+      printf ("MEMRAM of %lu bytes is too large for %d byte pages\n",
+              memramsz, pagesz);
+      exit (1);
+    }
   for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-    fscanf (file, "%d", &(memswpsz[sit]));
+    if (memswpsz[sit] / pagesz > PAGING_MAX_NRFRAME)
+      {
+        printf ("MEMSWP%d of %lu bytes is too large for %d byte pages\n", sit,
+                memswpsz[sit], pagesz);
+        exit (1);
+      }
+
+  if (numa_nodes < 1 || numa_nodes > PAGING_MAX_NODES
+      || (nrcpu == 0 && numa_nodes > num_cpus)
+      || numa_remote_lat < PAGING_NUMA_LOCAL_LAT)
+    {
+      printf ("Invalid number of NUMA nodes %d or remote latency %d\n",
+              numa_nodes, numa_remote_lat);
+      exit (1);
+    }
 
-  fscanf (file, "\n"); /* Final character */
+  if (nrcpu == 0)
+    for (sit = 0; sit < num_cpus; sit++)
+      cpu_node[sit] = sit * numa_nodes / num_cpus;
+  else if (nrcpu < num_cpus)
+    {
+      printf ("NUMA node of CPU %d missing\n", nrcpu);
+      exit (1);
+    }
+
+  for (sit = 0; sit < num_cpus; sit++)
+    if (cpu_node[sit] < 0 || cpu_node[sit] >= numa_nodes)
+      {
+        printf ("Invalid NUMA node %d of CPU %d\n", cpu_node[sit], sit);
+        exit (1);
+      }
 #endif
 #endif
 
 #ifdef MLQ_SCHED
   ld_processes.prio
       = (unsigned long *)malloc (sizeof (unsigned long) * num_processes);
+#endif
+#ifdef MM_MEMCG
+  ld_processes.memcg = (int *)malloc (sizeof (int) * num_processes);
 #endif
   int i;
   for (i = 0; i < num_processes; i++)
@@ -211,13 +419,47 @@ read_config (const char *path)
       ld_processes.path[i][0] = '\0';
       strcat (ld_processes.path[i], "input/proc/");
       char proc[100];
+      char procline[256];
+      int memcg = 0;
+      unsigned long limit = 0, soft = 0;
+
+      /* A process line may be followed by [MEMCG] [LIMIT] [SOFT_LIMIT]: the
+       * memory control group of the process (0 = root, unlimited) and, on
+       * the line of any member, the hard and soft limits of the group
+       * resident memory in bytes (0 = none)
+       */
+      procline[0] = '\0';
+#ifdef MM_PAGING
+      if (legacy && memline[0] != '\0')
+        { /* Read in place of the memory line */
+          strcpy (procline, memline);
+          memline[0] = '\0';
+        }
+      else
+#endif
+        while (fgets (procline, sizeof (procline), file) != NULL
+               && strspn (procline, " \t\r\n") == strlen (procline))
+          ;
 #ifdef MLQ_SCHED
-      fscanf (file, "%lu %s %lu\n", &ld_processes.start_time[i], proc,
-              &ld_processes.prio[i]);
+      sscanf (procline, "%lu %s %lu %d %lu %lu", &ld_processes.start_time[i],
+              proc, &ld_processes.prio[i], &memcg, &limit, &soft);
 #else
-      fscanf (file, "%lu %s\n", &ld_processes.start_time[i], proc);
+      sscanf (procline, "%lu %s %d %lu %lu", &ld_processes.start_time[i],
+              proc, &memcg, &limit, &soft);
 #endif
       strcat (ld_processes.path[i], proc);
+#ifdef MM_MEMCG
+      if (memcg < 0 || memcg >= PAGING_MAX_MEMCG
+          || ((limit > 0 || soft > 0)
+              && memcg_set_limit (memcg, DIV_ROUND_UP (limit, PAGING_PAGESZ),
+                                  DIV_ROUND_UP (soft, PAGING_PAGESZ))
+                     != 0))
+        {
+          printf ("Invalid memory control group %d\n", memcg);
+          exit (1);
+        }
+      ld_processes.memcg[i] = memcg;
+#endif
     }
 }
 
@@ -240,6 +482,14 @@ main (int argc, char *argv[])
   struct cpu_args *args
       = (struct cpu_args *)malloc (sizeof (struct cpu_args) * num_cpus);
   pthread_t ld;
+#ifdef MM_KSWAPD
+  pthread_t kswapd;
+  struct kswapd_args *kswapd_args = malloc (sizeof (struct kswapd_args));
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  pthread_t lc;
+  struct lc_args *lc_args = malloc (sizeof (struct lc_args));
+#endif
 
   /* Init timer */
   int i;
@@ -249,6 +499,12 @@ main (int argc, char *argv[])
       args[i].id = i;
     }
   struct timer_id_t *ld_event = attach_event ();
+#ifdef MM_KSWAPD
+  kswapd_args->timer_id = attach_event ();
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  lc_args->timer_id = attach_event ();
+#endif
   start_timer ();
 
 #ifdef MM_PAGING
@@ -257,14 +513,53 @@ main (int argc, char *argv[])
 
   struct memphy_struct mram;
   struct memphy_struct mswp[PAGING_MAX_MMSWP];
+  struct memphy_struct *mswp_tbl[PAGING_MAX_MMSWP];
 
   /* Create MEM RAM */
   init_memphy (&mram, memramsz, rdmflag);
+  if (MEMPHY_set_nodes (&mram, numa_nodes, numa_remote_lat) != 0)
+    {
+      printf ("MEMRAM cannot be split in %d nodes\n", numa_nodes);
+      exit (1);
+    }
+#ifdef MM_KSM
+  ksm_init (&mram);
+#endif
+#ifdef MM_MEMCG
+  mram.memcg_acct = 1;
+#endif
 
   /* Create all MEM SWAP */
   int sit;
+#ifdef MM_SEQ_SWAP
+  rdmflag = 0;
+#endif
   for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-    init_memphy (&mswp[sit], memswpsz[sit], rdmflag);
+    {
+#ifdef MM_SWAP_FILE
+      char swpfile[64];
+
+      snprintf (swpfile, sizeof (swpfile), MM_SWAP_FILE, sit);
+      if (init_memphy_file (&mswp[sit], memswpsz[sit], rdmflag, swpfile) != 0)
+        {
+          perror (swpfile);
+          init_memphy (&mswp[sit], memswpsz[sit], rdmflag);
+        }
+#else
+      init_memphy (&mswp[sit], memswpsz[sit], rdmflag);
+#endif
+      mswp_tbl[sit] = &mswp[sit];
+#ifdef MM_BLK
+#if MM_SWAP_POLICY == SWAP_TIER
+      /* Every tier is half as fast as the one before */
+      blk_init (&mswp[sit], MM_BLK_SCHED, PAGING_BLK_BANDWIDTH >> sit,
+                PAGING_BLK_LATENCY << sit);
+#else
+      blk_init (&mswp[sit], MM_BLK_SCHED, PAGING_BLK_BANDWIDTH,
+                PAGING_BLK_LATENCY);
+#endif
+#endif
+    }
 
   /* In Paging mode, it needs passing the system mem to each PCB through
    * loader*/
@@ -273,8 +568,16 @@ main (int argc, char *argv[])
 
   mm_ld_args->timer_id = ld_event;
   mm_ld_args->mram = (struct memphy_struct *)&mram;
-  mm_ld_args->mswp = (struct memphy_struct **)&mswp;
+  mm_ld_args->mswp = mswp_tbl;
   mm_ld_args->active_mswp = (struct memphy_struct *)&mswp[0];
+
+#ifdef MM_KSWAPD
+  kswapd_args->mram = &mram;
+  kswapd_args->mswp = &mswp[0];
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  lc_args->mram = &mram;
+#endif
 #endif
 
   /* Init scheduler */
@@ -290,6 +593,12 @@ main (int argc, char *argv[])
     {
       pthread_create (&cpu[i], NULL, cpu_routine, (void *)&args[i]);
     }
+#ifdef MM_KSWAPD
+  pthread_create (&kswapd, NULL, kswapd_routine, (void *)kswapd_args);
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  pthread_create (&lc, NULL, lc_routine, (void *)lc_args);
+#endif
 
   /* Wait for CPU and loader finishing */
   for (i = 0; i < num_cpus; i++)
@@ -297,9 +606,62 @@ main (int argc, char *argv[])
       pthread_join (cpu[i], NULL);
     }
   pthread_join (ld, NULL);
+#ifdef MM_KSWAPD
+  kswapd_stop = 1;
+  pthread_join (kswapd, NULL);
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  lc_stop = 1;
+  pthread_join (lc, NULL);
+#endif
 
   /* Stop timer */
   stop_timer ();
 
+#if defined(MM_PAGING) && defined(MM_BLK)
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    blk_unplug (&mswp[sit]);
+#endif
+
+#if defined(MM_PAGING) && defined(MMDBG)
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    {
+      char name[16];
+
+      if (mswp[sit].maxfpn == 0)
+        continue;
+
+      snprintf (name, sizeof (name), "MEMSWP%d", sit);
+      printf ("%s: %lu pages swapped out, %lu pages swapped in\n", name,
+              mswp[sit].nr_wrpg, mswp[sit].nr_rdpg);
+      if (!mswp[sit].rdmflg)
+        printf ("%s: %lu bytes of seek, %lu slots of seek latency\n", name,
+                mswp[sit].seek_dist, mswp[sit].seek_slots);
+#ifdef MM_BLK
+      blk_dump (&mswp[sit], name);
+#endif
+      if (mswp[sit].ring != NULL)
+        uring_dump (mswp[sit].ring, name);
+    }
+#ifdef MM_ZSWAP
+  zswap_dump ();
+#endif
+#ifdef MM_NUMA
+  numa_dump (&mram);
+#endif
+#ifdef MM_MEMCG
+  memcg_dump ();
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  load_control_dump ();
+#endif
+#endif
+
+#ifdef MM_PAGING
+  /* Flush the swap files for the next run */
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    MEMPHY_release (&mswp[sit]);
+#endif
+
   return 0;
 }
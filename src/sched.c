@@ -2,6 +2,9 @@
 #include "os-cfg.h"
 #include "queue.h"
 #include "sched.h"
+#ifdef SCHED_LOAD_CONTROL
+#include "mm.h"
+#endif
 #include <pthread.h>
 
 #include <stdio.h>
@@ -16,6 +19,37 @@ static struct queue_t mlq_ready_queue[MAX_PRIO];
 static uint32_t curr_prio;
 #endif
 
+#ifdef SCHED_LOAD_CONTROL
+/*
+ * Medium-term scheduler. The rate of the faults served from swap is
+ * sampled once per time slot. While it shows thrashing, the ready process
+ * of lowest priority is suspended: kept off the MLQ with its private pages
+ * evicted. Once the rate drops, the suspended processes come back together
+ * along with their working set, as they do whenever the MLQ runs dry. The
+ * queues change under queue_lock, the pages move without it: in between,
+ * the process is on no queue and counted in lc_nr_moving.
+ */
+
+/* Fault rate per CPU and time slot, scaled by LC_SCALE, over which a
+ * process is suspended and under which the suspended ones are resumed,
+ * and the time slots to wait between two decisions */
+#define LC_SCALE 16
+#define LC_THRASH_HIGH 8 /* one instruction in two faults */
+#define LC_THRASH_LOW 2
+#define LC_HOLD 8
+
+static struct queue_t suspended_queue;
+static unsigned long lc_majflt; /* fault count at the last sample */
+static unsigned long lc_rate;
+static int lc_hold;
+static int lc_nr_moving;         /* off every queue while its pages move */
+static pthread_cond_t lc_moved; /* signaled when one is queued again */
+
+/* Statistics */
+static unsigned long lc_nr_suspend, lc_nr_resume;
+static unsigned long lc_nr_pgout, lc_nr_pgin;
+#endif
+
 int
 queue_empty (void)
 {
@@ -46,6 +80,12 @@ init_scheduler (void)
           mlq_ready_queue[i].capacity * sizeof (struct pcb_t *));
       mlq_ready_queue[i].time_left = MAX_PRIO - i;
     }
+#endif
+#ifdef SCHED_LOAD_CONTROL
+  suspended_queue.size = 0;
+  suspended_queue.capacity = 0;
+  suspended_queue.proc = NULL;
+  pthread_cond_init (&lc_moved, NULL);
 #endif
   ready_queue.size = 0;
   ready_queue.capacity = MAX_QUEUE_SIZE;
@@ -68,6 +108,112 @@ queue_time_up ()
   return mlq_ready_queue[curr_prio].time_left == 0;
 }
 
+#ifdef SCHED_LOAD_CONTROL
+/*
+ *  lc_suspend - take the ready process of lowest priority off the MLQ
+ *
+ *  Another one is left ready. Called with queue_lock held, dropped while
+ *  its pages are evicted.
+ */
+static int
+lc_suspend (void)
+{
+  struct pcb_t *proc;
+  int prio, nr, nr_ready = 0;
+
+  for (prio = 0; prio < MAX_PRIO; prio++)
+    nr_ready += mlq_ready_queue[prio].size;
+
+  if (nr_ready < 2)
+    return -1;
+
+  for (prio = MAX_PRIO - 1; empty (&mlq_ready_queue[prio]); prio--)
+    ;
+
+  proc = dequeue (&mlq_ready_queue[prio]);
+  lc_nr_moving++;
+  pthread_mutex_unlock (&queue_lock);
+
+  /* Its frames go to the processes left running */
+  nr = swap_out_mm (proc->mram, proc->active_mswp, proc->mm);
+  printf ("\tLoad control: suspended process %2d, %d pages out\n", proc->pid,
+          nr);
+
+  pthread_mutex_lock (&queue_lock);
+  enqueue (&suspended_queue, proc);
+  lc_nr_moving--;
+  lc_nr_suspend++;
+  lc_nr_pgout += nr;
+  pthread_cond_broadcast (&lc_moved);
+
+  return 0;
+}
+
+/*
+ *  lc_resume - put every suspended process back on the MLQ
+ *
+ *  Called with queue_lock held, dropped while each one's pages come back.
+ */
+static void
+lc_resume (void)
+{
+  struct pcb_t *proc;
+  int nr;
+
+  while ((proc = dequeue (&suspended_queue)) != NULL)
+    {
+      lc_nr_moving++;
+      pthread_mutex_unlock (&queue_lock);
+
+      nr = swap_in_mm (proc);
+      printf ("\tLoad control: resumed process %2d, %d pages in\n", proc->pid,
+              nr);
+
+      pthread_mutex_lock (&queue_lock);
+      enqueue (&mlq_ready_queue[proc->prio], proc);
+      lc_nr_moving--;
+      lc_nr_resume++;
+      lc_nr_pgin += nr;
+      pthread_cond_broadcast (&lc_moved);
+    }
+}
+
+void
+load_control (struct memphy_struct *mram, int nr_cpus)
+{
+  unsigned long majflt = __atomic_load_n (&mram->nr_majflt, __ATOMIC_RELAXED);
+
+  /* Smoothed over the last few time slots */
+  lc_rate = (3 * lc_rate + (majflt - lc_majflt) * LC_SCALE / nr_cpus) / 4;
+  lc_majflt = majflt;
+
+  /* Give the last decision time to show */
+  if (lc_hold > 0)
+    {
+      lc_hold--;
+      return;
+    }
+
+  pthread_mutex_lock (&queue_lock);
+  if (lc_rate >= LC_THRASH_HIGH && lc_suspend () == 0)
+    lc_hold = LC_HOLD;
+  else if (lc_rate <= LC_THRASH_LOW && !empty (&suspended_queue))
+    {
+      lc_resume ();
+      lc_hold = LC_HOLD;
+    }
+  pthread_mutex_unlock (&queue_lock);
+}
+
+void
+load_control_dump (void)
+{
+  printf ("LOAD CONTROL: %lu suspended, %lu resumed, %lu pages out, "
+          "%lu pages in\n",
+          lc_nr_suspend, lc_nr_resume, lc_nr_pgout, lc_nr_pgin);
+}
+#endif
+
 struct pcb_t *
 get_mlq_proc (void)
 {
@@ -77,6 +223,20 @@ get_mlq_proc (void)
    * Use lock to protect the queue.
    * */
 
+#ifdef SCHED_LOAD_CONTROL
+  /* Nothing else to run, the suspended processes are back. One still
+   * moving would be left behind by a CPU stopping now, wait for it */
+  while (queue_empty ())
+    {
+      if (!empty (&suspended_queue))
+        lc_resume ();
+      else if (lc_nr_moving > 0)
+        pthread_cond_wait (&lc_moved, &queue_lock);
+      else
+        break;
+    }
+#endif
+
   /* Check if the ENTIRE MULTI-QUEUE is empty */
   if (queue_empty ())
     {